@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "audio-file.h"
+#include "config.h"
+#include "interpolation.h"
+#include "log.h"
+#include "mix.h"
+#include "synthesizer.h"
+#include "xmalloc.h"
+
+/* Benchmark of synthesize over a grid of profiles and block
+ * sizes. Every point of the grid renders from a fresh
+ * synthesizer with the same seed, after a warm-up, and
+ * writes one tab separated line of results to the -o file,
+ * or to stdout between the log lines */
+
+/* Length and sample rate of the synthetic source */
+#define SOURCE_TIME 10
+#define SOURCE_RATE 48000
+
+/* Seconds rendered before timing starts */
+#define WARMUP_TIME .5
+
+#define MAX_AXIS 16
+
+/* Held pitch classes, grains play at the pitch of a held
+ * class times a random octave factor */
+struct pitch_set {
+  const char    *name;
+  unsigned int   mask;
+};
+
+static const struct pitch_set s_pitch_sets[] = {
+  { "octaves",   0x001 },    /* Multipliers 1/8 to 4, including the original rate */
+  { "triad",     0x091 },
+  { "chromatic", 0xfff },
+};
+
+struct grid {
+  unsigned long  slots[MAX_AXIS];
+  size_t         num_slots;
+  float          min_length[MAX_AXIS];
+  float          max_length[MAX_AXIS];
+  size_t         num_lengths;
+  const struct pitch_set *pitches[MAX_AXIS];
+  size_t         num_pitches;
+  float          reverse[MAX_AXIS];
+  size_t         num_reverse;
+  unsigned long  blocks[MAX_AXIS];
+  size_t         num_blocks;
+  int            interpolation[MAX_AXIS];
+  size_t         num_interpolations;
+};
+
+struct result {
+  double         ns_per_sample;
+  double         grains_per_sec;
+  double         p50;                    /* Block times in microseconds */
+  double         p99;
+  double         max;
+};
+
+static double get_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/* Split a comma separated list, calling parse on every item.
+ * Returns the number of items or -1 on failure */
+static int parse_list(const char *s, int (*parse)(const char *item, void *axis, size_t i),
+                      void *axis)
+{
+  char *text = strdup(s);
+  char *save;
+  size_t n = 0;
+
+  for (char *tok = strtok_r(text, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    if (n == MAX_AXIS || parse(tok, axis, n) < 0) {
+      free(text);
+      return -1;
+    }
+    n++;
+  }
+
+  free(text);
+  return n ? (int) n : -1;
+}
+
+static int parse_ulong(const char *item, void *axis, size_t i)
+{
+  char *end;
+  unsigned long v = strtoul(item, &end, 0);
+
+  if (*end != 0 || v == 0) {
+    return -1;
+  }
+
+  ((unsigned long *) axis)[i] = v;
+  return 0;
+}
+
+static int parse_probability(const char *item, void *axis, size_t i)
+{
+  char *end;
+  float v = strtof(item, &end);
+
+  if (*end != 0 || v < 0.f || v > 1.f) {
+    return -1;
+  }
+
+  ((float *) axis)[i] = v;
+  return 0;
+}
+
+/* <min>:<max> in seconds */
+static int parse_length(const char *item, void *axis, size_t i)
+{
+  struct grid *grid = axis;
+  char *end;
+
+  float min = strtof(item, &end);
+  if (*end != ':') {
+    return -1;
+  }
+  float max = strtof(end + 1, &end);
+  if (*end != 0 || min <= 0.f || max < min) {
+    return -1;
+  }
+
+  grid->min_length[i] = min;
+  grid->max_length[i] = max;
+  return 0;
+}
+
+static int parse_pitches(const char *item, void *axis, size_t i)
+{
+  for (size_t p = 0; p < sizeof(s_pitch_sets) / sizeof(*s_pitch_sets); ++p) {
+    if (strcmp(s_pitch_sets[p].name, item) == 0) {
+      ((const struct pitch_set **) axis)[i] = &s_pitch_sets[p];
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+static int parse_interpolation(const char *item, void *axis, size_t i)
+{
+  int interpolation = get_interpolation_by_name(item);
+
+  if (interpolation < 0) {
+    return -1;
+  }
+
+  ((int *) axis)[i] = interpolation;
+  return 0;
+}
+
+/* Noise and a few sines, so grains don't all sound the same */
+static void make_source(struct audio_file *af)
+{
+  uint32_t state = 1;
+
+  af->size = SOURCE_TIME * SOURCE_RATE;
+  af->samplerate = SOURCE_RATE;
+  af->channels = 1;
+  af->data = xmalloc(sizeof(*af->data) * (af->size + 2 * AUDIO_FILE_GUARD));
+  af->data += AUDIO_FILE_GUARD;
+
+  for (unsigned int i = 0; i < af->size; ++i) {
+    state = state * 1664525u + 1013904223u;
+    float t = (float) i / SOURCE_RATE;
+    af->data[i] = .3f * sinf(2.f * (float) M_PI * 220.f * t) +
+                  .2f * sinf(2.f * (float) M_PI * 331.f * t) +
+                  .1f * ((float) (state >> 8) / (float) (1 << 24) - .5f);
+  }
+
+  fill_audio_file_guards(af);
+  build_audio_file_levels(af);
+}
+
+static void run_point(struct audio_file *af, struct profile *profile, unsigned int pitches,
+                      size_t block, double duration, size_t threads, struct result *result)
+{
+  struct synthesizer *syn = create_synthesizer(af);
+  synthesizer_set_seed(syn, 1);
+  set_synthesizer_profile(syn, profile, 1);
+  synthesizer_reserve(syn, block, profile->num_slots);
+  synthesizer_set_threads(syn, threads);
+
+  for (int pitch = 0; pitch < 12; ++pitch) {
+    if (pitches & 1u << pitch) {
+      synthesizer_note_on(syn, pitch);
+    }
+  }
+
+  size_t warmup = (size_t) (WARMUP_TIME * af->samplerate) / block + 1;
+  for (size_t i = 0; i < warmup; ++i) {
+    synthesize(syn, block);
+  }
+
+  size_t num_blocks = (size_t) (duration * af->samplerate) / block + 1;
+  double *times = xmalloc(sizeof(*times) * num_blocks);
+  uint64_t grains = synthesizer_get_grain_count(syn);
+  double start = get_time();
+
+  for (size_t i = 0; i < num_blocks; ++i) {
+    double t = get_time();
+    synthesize(syn, block);
+    times[i] = get_time() - t;
+  }
+
+  double elapsed = get_time() - start;
+  grains = synthesizer_get_grain_count(syn) - grains;
+
+  qsort(times, num_blocks, sizeof(*times), compare_double);
+  result->ns_per_sample = elapsed * 1e9 / (double) (num_blocks * block);
+  result->grains_per_sec = (double) grains / elapsed;
+  result->p50 = times[(num_blocks - 1) / 2] * 1e6;
+  result->p99 = times[(size_t) ((num_blocks - 1) * .99)] * 1e6;
+  result->max = times[num_blocks - 1] * 1e6;
+
+  free(times);
+  free_synthesizer(syn);
+}
+
+int main(int argc, char **argv)
+{
+  (void) argc;
+
+  const char *source_path = NULL;
+  const char *output_path = NULL;
+  double duration = 1.;
+  unsigned long threads = 1;
+  struct grid grid = {
+    .slots = { 8, 32, 128 },
+    .num_slots = 3,
+    .min_length = { .01f, .05f, .2f },
+    .max_length = { .05f, .2f, 1.f },
+    .num_lengths = 3,
+    .pitches = { &s_pitch_sets[0], &s_pitch_sets[2] },
+    .num_pitches = 2,
+    .reverse = { 0.f, .5f },
+    .num_reverse = 2,
+    .blocks = { 64, 256, 1024 },
+    .num_blocks = 3,
+    .interpolation = { INTERPOLATION_LINEAR },
+    .num_interpolations = 1,
+  };
+
+  log_init();
+
+  /* Parse command line arguments */
+  for (argv++; *argv; ++argv) {
+    const char *arg = *argv;
+    int n = 0;
+
+    if (arg[0] != '-' || arg[1] == 0) {
+      log_err("Invalid argument '%s'", arg);
+      return -1;
+    }
+
+    int c = arg[1];
+    arg += 2;
+    if (strlen(arg) == 0) {
+      argv++;
+      arg = *argv;
+    }
+    if (arg == NULL) {
+      log_err("Missing value for '-%c'", c);
+      return -1;
+    }
+
+    switch (c) {
+    case 'f':
+      source_path = arg;
+      break;
+    case 'o':
+      output_path = arg;
+      break;
+    case 'd':
+    {
+      char *end;
+      duration = strtod(arg, &end);
+      n = *end == 0 && duration > 0. ? 1 : -1;
+      break;
+    }
+    case 't':
+      n = parse_ulong(arg, &threads, 0);
+      break;
+    case 'n':
+      n = parse_list(arg, parse_ulong, grid.slots);
+      grid.num_slots = n;
+      break;
+    case 'l':
+      n = parse_list(arg, parse_length, &grid);
+      grid.num_lengths = n;
+      break;
+    case 'm':
+      n = parse_list(arg, parse_pitches, grid.pitches);
+      grid.num_pitches = n;
+      break;
+    case 'r':
+      n = parse_list(arg, parse_probability, grid.reverse);
+      grid.num_reverse = n;
+      break;
+    case 'b':
+      n = parse_list(arg, parse_ulong, grid.blocks);
+      grid.num_blocks = n;
+      break;
+    case 'i':
+      n = parse_list(arg, parse_interpolation, grid.interpolation);
+      grid.num_interpolations = n;
+      break;
+    default:
+      log_err("Unknown option '-%c'", c);
+      return -1;
+    }
+
+    if (n < 0) {
+      log_err("Invalid value for '-%c': '%s'", c, arg);
+      return -1;
+    }
+  }
+
+  struct audio_file af = {0};
+  if (source_path) {
+    const char *err = load_audio_file(source_path, &af);
+    if (err != NULL) {
+      log_err("Failed to load audio file %s: %s", source_path, err);
+      return -1;
+    }
+  } else {
+    make_source(&af);
+  }
+
+  FILE *out = stdout;
+  if (output_path) {
+    out = fopen(output_path, "w");
+    if (out == NULL) {
+      log_err("Failed to open %s", output_path);
+      return -1;
+    }
+  }
+
+  const char *kernels = mix_select()->name;
+
+  fprintf(out, "kernels\tinterpolation\tslots\tmin_length\tmax_length\tpitches\treverse\t"
+               "block\tthreads\tns_per_sample\tgrains_per_sec\tblock_p50_us\tblock_p99_us\t"
+               "block_max_us\n");
+
+  struct profile profile = {
+    .min_offset = .01f,
+    .max_offset = 2.f,
+    .min_cooldown = .01f,
+    .max_cooldown = 2.f,
+    .min_gain = .01f,
+    .max_gain = 1.f,
+    .window = WINDOW_TRIANGLE,
+  };
+
+  for (size_t in = 0; in < grid.num_interpolations; ++in)
+  for (size_t sl = 0; sl < grid.num_slots; ++sl)
+  for (size_t le = 0; le < grid.num_lengths; ++le)
+  for (size_t pi = 0; pi < grid.num_pitches; ++pi)
+  for (size_t re = 0; re < grid.num_reverse; ++re)
+  for (size_t bl = 0; bl < grid.num_blocks; ++bl) {
+    struct result result;
+
+    profile.interpolation = grid.interpolation[in];
+    profile.num_slots = grid.slots[sl];
+    profile.min_length = grid.min_length[le];
+    profile.max_length = grid.max_length[le];
+    profile.reverse_probability = grid.reverse[re];
+
+    run_point(&af, &profile, grid.pitches[pi]->mask, grid.blocks[bl], duration, threads, &result);
+
+    fprintf(out, "%s\t%s\t%u\t%g\t%g\t%s\t%g\t%lu\t%lu\t%.3f\t%.0f\t%.1f\t%.1f\t%.1f\n",
+            kernels, get_interpolation_name(profile.interpolation), profile.num_slots,
+            profile.min_length, profile.max_length, grid.pitches[pi]->name,
+            profile.reverse_probability, grid.blocks[bl], threads,
+            result.ns_per_sample, result.grains_per_sec, result.p50, result.p99, result.max);
+    fflush(out);
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  free_audio_file(&af);
+
+  return 0;
+}
@@ -9,6 +9,7 @@ pkgs.stdenv.mkDerivation {
   buildInputs = with pkgs; [
     pkg-config
     pulseaudio
+    alsa-lib
     libsndfile
     cjson
     portmidi
@@ -0,0 +1,220 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+#include "log.h"
+#include "event.h"
+#include "audio-backend.h"
+#include "xmalloc.h"
+
+/* Latency used unless a target latency is set, in microseconds */
+#define ALSA_DEFAULT_LATENCY 100000
+
+static char s_errorbuf[512] = {0};
+
+static snd_pcm_t *s_pcm = NULL;
+static unsigned int s_channels;
+static unsigned int s_samplerate;
+
+/* Frames written per period */
+static snd_pcm_uframes_t s_period_size;
+
+/* Buffer of one period, rendered in to before writing */
+static float *s_period;
+
+static pthread_t s_thread;
+static int s_thread_started = 0;
+static atomic_int s_quit;
+
+static void cleanup(void)
+{
+  if (s_thread_started) {
+    atomic_store_explicit(&s_quit, 1, memory_order_release);
+    pthread_join(s_thread, NULL);
+  }
+
+  close_stream_source();
+
+  if (s_pcm) {
+    snd_pcm_close(s_pcm);
+  }
+
+  free(s_period);
+}
+
+static int alsa_init(void)
+{
+  atomic_init(&s_quit, 0);
+  atexit(cleanup);
+
+  return 0;
+}
+
+static struct list *alsa_list_sinks(void)
+{
+  struct list *list = NULL;
+  void **hints;
+
+  if (snd_device_name_hint(-1, "pcm", &hints) < 0) {
+    return NULL;
+  }
+
+  for (void **h = hints; *h; ++h) {
+    char *name = snd_device_name_get_hint(*h, "NAME");
+    char *description = snd_device_name_get_hint(*h, "DESC");
+    char *ioid = snd_device_name_get_hint(*h, "IOID");
+
+    /* No IOID means the device does both input and output */
+    if (name && (ioid == NULL || strcmp(ioid, "Output") == 0)) {
+      struct list *l = xcalloc(1, sizeof(*l));
+      l->name = strdup(name);
+      l->description = strdup(description ? description : name);
+      l->next = list;
+      list = l;
+    }
+
+    free(name);
+    free(description);
+    free(ioid);
+  }
+
+  snd_device_name_free_hint(hints);
+
+  /* Index in the order of the hints */
+  unsigned int index = 0;
+  for (struct list *l = list; l; l = l->next) {
+    l->index = index++;
+  }
+
+  return list;
+}
+
+static int alsa_connect_sink(const char *name, const struct stream_settings *settings)
+{
+  snd_pcm_uframes_t buffer_size;
+  int err;
+
+  name = name ? name : "default";
+
+  err = snd_pcm_open(&s_pcm, name, SND_PCM_STREAM_PLAYBACK, 0);
+  if (err < 0) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf),
+             "Failed to open %s: %s", name, snd_strerror(err));
+    s_pcm = NULL;
+    return -1;
+  }
+
+  /* The minimum request has no equivalent here,
+   * ALSA derives the period from the latency */
+  unsigned int latency = settings->latency ? settings->latency * 1000 : ALSA_DEFAULT_LATENCY;
+  err = snd_pcm_set_params(s_pcm, SND_PCM_FORMAT_FLOAT, SND_PCM_ACCESS_RW_INTERLEAVED,
+                           settings->channels, settings->samplerate, 1, latency);
+  if (err < 0) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf),
+             "Failed to configure %s: %s", name, snd_strerror(err));
+    return -1;
+  }
+
+  err = snd_pcm_get_params(s_pcm, &buffer_size, &s_period_size);
+  if (err < 0) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf),
+             "Failed to read back parameters of %s: %s", name, snd_strerror(err));
+    return -1;
+  }
+
+  s_channels = settings->channels;
+  s_samplerate = settings->samplerate;
+  s_period = xcalloc(s_period_size * s_channels, sizeof(*s_period));
+
+  log_info("Stream buffer: %.1f ms, period %.1f ms",
+           1000.0 * buffer_size / settings->samplerate,
+           1000.0 * s_period_size / settings->samplerate);
+
+  return 0;
+}
+
+static const char *alsa_get_error_string(void)
+{
+  return s_errorbuf;
+}
+
+/* Stop the application rather than run on without sound */
+static void stream_failed(int err)
+{
+  log_warn_async("Stream failed: %s", snd_strerror(err));
+
+  struct event ev = { .type = EVENT_QUIT, };
+  queue_event(&ev);
+}
+
+/* Render a period at a time and block in the write until
+ * the device has room for it */
+static void *alsa_main(void *arg)
+{
+  (void) arg;
+
+  while (!atomic_load_explicit(&s_quit, memory_order_acquire)) {
+    fill_stream(s_period, s_period_size * s_channels);
+
+    for (snd_pcm_uframes_t t = 0; t < s_period_size;) {
+      snd_pcm_sframes_t n = snd_pcm_writei(s_pcm, s_period + t * s_channels, s_period_size - t);
+
+      if (n < 0) {
+        if (n == -EPIPE) {
+          log_warn_async("Stream notify: Underflow");
+        }
+
+        int err = snd_pcm_recover(s_pcm, n, 1);
+        if (err < 0) {
+          stream_failed(err);
+          return NULL;
+        }
+        continue;
+      }
+
+      t += n;
+    }
+  }
+
+  return NULL;
+}
+
+static int alsa_start_stream(struct synthesizer *syn)
+{
+  if (open_stream_source(syn, s_period_size * s_channels, s_period_size * s_channels) < 0) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf), "Failed to start render thread");
+    return -1;
+  }
+
+  if (pthread_create(&s_thread, NULL, alsa_main, NULL) != 0) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf), "Failed to start stream thread");
+    return -1;
+  }
+  s_thread_started = 1;
+
+  return 0;
+}
+
+static long alsa_get_delay(void)
+{
+  snd_pcm_sframes_t frames;
+
+  if (s_pcm == NULL || snd_pcm_delay(s_pcm, &frames) < 0) {
+    return -1;
+  }
+
+  return frames > 0 ? (long) (frames * 1000000LL / s_samplerate) : 0;
+}
+
+const struct audio_backend alsa_backend = {
+  .name             = "alsa",
+  .init             = alsa_init,
+  .list_sinks       = alsa_list_sinks,
+  .connect_sink     = alsa_connect_sink,
+  .start_stream     = alsa_start_stream,
+  .get_delay        = alsa_get_delay,
+  .get_error_string = alsa_get_error_string,
+};
@@ -0,0 +1,50 @@
+#ifndef AUDIO_BACKEND_H
+#define AUDIO_BACKEND_H
+
+#include <stddef.h>
+
+#include "audio.h"
+#include "synthesizer.h"
+
+/* Stream settings collected before connecting */
+struct stream_settings {
+  unsigned int   samplerate;
+  unsigned int   channels;
+  unsigned int   latency;          /* Target latency in milliseconds, 0 for the default */
+  unsigned int   minreq;           /* Minimum request in milliseconds, 0 for the default */
+};
+
+/* Functions of the audio layer an audio backend implements.
+ * Errors are returned as -1, with a message from
+ * get_error_string */
+struct audio_backend {
+  const char    *name;
+  int          (*init)(void);
+  struct list *(*list_sinks)(void);
+  int          (*connect_sink)(const char *name, const struct stream_settings *settings);
+  int          (*start_stream)(struct synthesizer *syn);
+  long         (*get_delay)(void);   /* Microseconds buffered ahead of the next write, -1 if unknown */
+  const char  *(*get_error_string)(void);
+};
+
+extern const struct audio_backend pulse_backend;
+extern const struct audio_backend alsa_backend;
+extern const struct audio_backend null_backend;
+
+/* Shared by the backends: render for a stream asking for up
+ * to max_request samples at a time, usually request samples.
+ * Starts the render thread if rendering ahead, with a ring of
+ * blocks requests, otherwise reserves room in the synthesizer.
+ * Returns -1 if the render thread failed */
+int open_stream_source(struct synthesizer *syn, size_t max_request, size_t request);
+void close_stream_source(void);
+
+/* Microseconds rendered ahead in the ring of the render
+ * thread, 0 if not rendering ahead */
+long get_stream_source_delay(void);
+
+/* Fill out with the next n samples of the stream. Real-time
+ * safe, called on the thread of the stream */
+void fill_stream(float *out, size_t n);
+
+#endif
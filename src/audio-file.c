@@ -1,5 +1,6 @@
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include <sndfile.h>
 
 #include "log.h"
@@ -19,8 +20,14 @@ const char *load_audio_file(const char *path, struct audio_file *af)
     return sf_strerror(file);
   }
 
+  if (info.frames == 0) {
+    sf_close(file);
+    return "Audio file is empty";
+  }
+
   af->size = info.channels * info.frames;
-  af->data = xmalloc(sizeof(*af->data) * af->size);
+  af->data = xmalloc(sizeof(*af->data) * (af->size + 2 * AUDIO_FILE_GUARD));
+  af->data += AUDIO_FILE_GUARD;
   af->channels = info.channels;
   af->samplerate = info.samplerate;
 
@@ -45,11 +52,99 @@ const char *load_audio_file(const char *path, struct audio_file *af)
     af->channels = 1;
   }
 
+  fill_audio_file_guards(af);
+  build_audio_file_levels(af);
+
   return NULL;
 }
 
+static void fill_guards(float *data, unsigned int size)
+{
+  for (size_t i = 1; i <= AUDIO_FILE_GUARD; ++i) {
+    data[-(long) i] = data[size - 1 - (i - 1) % size];
+  }
+
+  for (size_t i = 0; i < AUDIO_FILE_GUARD; ++i) {
+    data[size + i] = data[i % size];
+  }
+}
+
+void fill_audio_file_guards(struct audio_file *af)
+{
+  fill_guards(af->data, af->size);
+}
+
+/* Half-band low-pass filter applied before each decimation,
+ * a Blackman windowed sinc of 2 * LEVEL_FILTER_HALF + 1 taps */
+#define LEVEL_FILTER_HALF   16
+#define LEVEL_FILTER_CUTOFF .225
+
+static void level_filter(float *h)
+{
+  const double pi = 3.14159265358979323846;
+  const int taps = 2 * LEVEL_FILTER_HALF + 1;
+  double sum = 0.;
+
+  for (int k = 0; k < taps; ++k) {
+    double x = k - LEVEL_FILTER_HALF;
+    double sinc = x == 0. ? 1. : sin(2. * pi * LEVEL_FILTER_CUTOFF * x) / (2. * pi * LEVEL_FILTER_CUTOFF * x);
+    double w = .42 - .5 * cos(2. * pi * k / (taps - 1)) + .08 * cos(4. * pi * k / (taps - 1));
+    h[k] = (float) (sinc * w);
+    sum += h[k];
+  }
+
+  /* Unity gain at DC */
+  for (int k = 0; k < taps; ++k) {
+    h[k] = (float) (h[k] / sum);
+  }
+}
+
+void build_audio_file_levels(struct audio_file *af)
+{
+  float h[2 * LEVEL_FILTER_HALF + 1];
+
+  level_filter(h);
+
+  af->levels[0] = af->data;
+  af->level_size[0] = af->size;
+
+  for (int l = 1; l < AUDIO_FILE_LEVELS; ++l) {
+    const float *src = af->levels[l - 1];
+    long src_size = af->level_size[l - 1];
+    unsigned int size = (unsigned int) ((src_size + 1) / 2);
+    float *dst;
+
+    if (af->levels[l]) {
+      free(af->levels[l] - AUDIO_FILE_GUARD);
+    }
+    dst = xmalloc(sizeof(*dst) * (size + 2 * AUDIO_FILE_GUARD));
+    dst += AUDIO_FILE_GUARD;
+
+    /* The file loops, so the filter wraps around its ends */
+    for (long i = 0; i < (long) size; ++i) {
+      float acc = 0.f;
+      for (long k = 0; k < 2 * LEVEL_FILTER_HALF + 1; ++k) {
+        long j = (2 * i + k - LEVEL_FILTER_HALF) % src_size;
+        acc += h[k] * src[j < 0 ? j + src_size : j];
+      }
+      dst[i] = acc;
+    }
+
+    fill_guards(dst, size);
+    af->levels[l] = dst;
+    af->level_size[l] = size;
+  }
+}
+
 void free_audio_file(struct audio_file *af)
 {
-  free(af->data);
+  if (af->data) {
+    free(af->data - AUDIO_FILE_GUARD);
+  }
+  for (int l = 1; l < AUDIO_FILE_LEVELS; ++l) {
+    if (af->levels[l]) {
+      free(af->levels[l] - AUDIO_FILE_GUARD);
+    }
+  }
   memset(af, 0, sizeof(*af));
 }
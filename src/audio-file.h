@@ -1,17 +1,38 @@
 #ifndef AUDIO_FILE_H
 #define AUDIO_FILE_H
 
+/* Number of samples of wrap-around padding stored before and
+ * after the data, data[-i] == data[size - i] and data[size + i]
+ * == data[i]. Lets grains read across the ends of the file
+ * without wrapping every position */
+#define AUDIO_FILE_GUARD 64
+
+/* Number of mip levels. Level l is the data low-pass filtered
+ * and decimated by 2^l, for grains played at high rates */
+#define AUDIO_FILE_LEVELS 4
+
 struct audio_file {
-  float        *data;
+  float        *data; /* Padded with AUDIO_FILE_GUARD on each side */
   unsigned int  size; /* Number of samples */
   unsigned int  samplerate;
   unsigned int  channels;
+
+  float        *levels[AUDIO_FILE_LEVELS];     /* Padded like data, levels[0] is data */
+  unsigned int  level_size[AUDIO_FILE_LEVELS];
 };
 
 /* Load an audio file from disk.
  * Returns NULL or an error string. */
 const char *load_audio_file(const char *path, struct audio_file *af);
 
+/* Fill the guard regions from the data. Must be called
+ * when the data is modified */
+void fill_audio_file_guards(struct audio_file *af);
+
+/* Build the mip levels from the data. Must be called when
+ * the data is modified, after fill_audio_file_guards */
+void build_audio_file_levels(struct audio_file *af);
+
 void free_audio_file(struct audio_file *af);
 
 #endif
@@ -0,0 +1,159 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "log.h"
+#include "audio-backend.h"
+#include "xmalloc.h"
+
+/* Frames rendered per block unless a target latency is set */
+#define NULL_DEFAULT_BLOCK 1024
+
+static char s_errorbuf[512] = {0};
+
+static unsigned int s_samplerate;
+static unsigned int s_channels;
+
+/* Frames rendered per block */
+static size_t s_block_size;
+
+/* Rendered block, discarded after rendering */
+static float *s_block;
+
+static pthread_t s_thread;
+static int s_thread_started = 0;
+static atomic_int s_quit;
+
+static void cleanup(void)
+{
+  if (s_thread_started) {
+    atomic_store_explicit(&s_quit, 1, memory_order_release);
+    pthread_join(s_thread, NULL);
+  }
+
+  close_stream_source();
+  free(s_block);
+}
+
+static int null_init(void)
+{
+  atomic_init(&s_quit, 0);
+  atexit(cleanup);
+
+  return 0;
+}
+
+static struct list *null_list_sinks(void)
+{
+  struct list *l = xcalloc(1, sizeof(*l));
+  l->index = 0;
+  l->name = strdup("null");
+  l->description = strdup("Discards the output at real-time pace");
+
+  return l;
+}
+
+static int null_connect_sink(const char *name, const struct stream_settings *settings)
+{
+  (void) name;
+
+  s_samplerate = settings->samplerate;
+  s_channels = settings->channels;
+
+  if (settings->latency) {
+    s_block_size = (size_t) settings->latency * s_samplerate / 1000;
+    s_block_size = s_block_size ? s_block_size : 1;
+  } else {
+    s_block_size = NULL_DEFAULT_BLOCK;
+  }
+
+  s_block = xcalloc(s_block_size * s_channels, sizeof(*s_block));
+
+  log_info("Stream buffer: %.1f ms", 1000.0 * s_block_size / s_samplerate);
+
+  return 0;
+}
+
+static const char *null_get_error_string(void)
+{
+  return s_errorbuf;
+}
+
+static void timespec_add_ns(struct timespec *ts, long ns)
+{
+  ts->tv_nsec += ns;
+  while (ts->tv_nsec >= 1000000000L) {
+    ts->tv_nsec -= 1000000000L;
+    ts->tv_sec++;
+  }
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b)
+{
+  return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* Render a block per block period against an absolute
+ * clock, so time spent rendering doesn't add up as drift */
+static void *null_main(void *arg)
+{
+  (void) arg;
+  long period = (long) (1000000000.0 * s_block_size / s_samplerate);
+  unsigned long late = 0;
+  struct timespec next;
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (!atomic_load_explicit(&s_quit, memory_order_acquire)) {
+    fill_stream(s_block, s_block_size * s_channels);
+
+    /* A block finished after its deadline would have been
+     * an underflow on a real device */
+    timespec_add_ns(&next, period);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_before(&next, &now)) {
+      log_warn_async("Stream fell behind real time, %lu blocks late so far", ++late);
+      next = now;
+    }
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+
+  return NULL;
+}
+
+static int null_start_stream(struct synthesizer *syn)
+{
+  if (open_stream_source(syn, s_block_size * s_channels, s_block_size * s_channels) < 0) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf), "Failed to start render thread");
+    return -1;
+  }
+
+  if (pthread_create(&s_thread, NULL, null_main, NULL) != 0) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf), "Failed to start stream thread");
+    return -1;
+  }
+  s_thread_started = 1;
+
+  return 0;
+}
+
+/* Blocks are dropped as soon as they are rendered */
+static long null_get_delay(void)
+{
+  return 0;
+}
+
+const struct audio_backend null_backend = {
+  .name             = "null",
+  .init             = null_init,
+  .list_sinks       = null_list_sinks,
+  .connect_sink     = null_connect_sink,
+  .start_stream     = null_start_stream,
+  .get_delay        = null_get_delay,
+  .get_error_string = null_get_error_string,
+};
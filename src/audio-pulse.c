@@ -0,0 +1,474 @@
+#include <string.h>
+#include <stdio.h>
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+
+#include "log.h"
+#include "audio-backend.h"
+#include "xmalloc.h"
+
+/* Names for publicly visible PulseAudio objects */
+static const char *s_application_name = "Anomi";
+static const char *s_playback_stream_name = "Anomi Output";
+
+static char s_errorbuf[512] = {0};
+
+/* Status flag for callbacks that might fail */
+static int s_ok;
+
+/* Status flag for running pa_operations */
+static int s_op_done;
+
+/* Buffer length used unless a target latency is set */
+#define DEFAULT_BUFFER_TIME (1 * PA_USEC_PER_SEC)
+
+/* Interval between latency reports in low-latency mode */
+#define LATENCY_REPORT_INTERVAL (5 * PA_USEC_PER_SEC)
+
+/* Underflows within one report interval after which
+ * the target latency is raised by half */
+#define UNDERFLOW_LIMIT 3
+
+/* Largest and usual request of the stream in bytes */
+static size_t s_max_request;
+static size_t s_min_request;
+
+/* Target latency in microseconds, 0 if left to the default */
+static pa_usec_t s_latency = 0;
+
+/* Underflows since the last latency report */
+static unsigned int s_underflows = 0;
+
+/* PulseAudio objects */
+static pa_context *s_context;
+static pa_threaded_mainloop *s_mainloop;
+static pa_stream *s_playback_stream = NULL;
+
+/* List with sink/source info */
+static struct list *s_list;
+
+/* Default sample spec, rate and channels
+ * are set when connecting */
+static pa_sample_spec s_default_sample_spec;
+
+static int is_litte_endian_system(void)
+{
+  int x = 1;
+  return *(char*) &x == 1;
+}
+
+static void context_connect_callback(pa_context *context, void *userdata)
+{
+  (void) context;
+  (void) userdata;
+  enum pa_context_state state;
+
+  state = pa_context_get_state(s_context);
+  switch (state) {
+  case PA_CONTEXT_READY:
+    s_ok = 1;
+    __attribute__((fallthrough));
+  case PA_CONTEXT_FAILED:
+    pa_threaded_mainloop_signal(s_mainloop, 0);
+    break;
+  default:
+    break;
+  }
+}
+
+/* Callbacks run on the mainloop thread and read from the
+ * stream source, so the stream is disconnected under the
+ * mainloop lock and the thread joined before it is closed */
+static void cleanup(void)
+{
+  pa_threaded_mainloop_lock(s_mainloop);
+  if (s_playback_stream) {
+    pa_stream_disconnect(s_playback_stream);
+    pa_stream_unref(s_playback_stream);
+    s_playback_stream = NULL;
+  }
+  pa_context_disconnect(s_context);
+  pa_threaded_mainloop_unlock(s_mainloop);
+
+  pa_threaded_mainloop_stop(s_mainloop);
+
+  close_stream_source();
+}
+
+static int pulse_init(void)
+{
+  /* Start mainloop */
+  s_mainloop = pa_threaded_mainloop_new();
+  pa_mainloop_api *api = pa_threaded_mainloop_get_api(s_mainloop);
+  s_context = pa_context_new(api, s_application_name);
+  pa_threaded_mainloop_start(s_mainloop);
+
+  /* Connect to PulseAudio server */
+  s_ok = 0;
+  pa_threaded_mainloop_lock(s_mainloop);
+  pa_context_set_state_callback(s_context, context_connect_callback, NULL);
+  pa_context_connect(s_context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL);
+  pa_threaded_mainloop_wait(s_mainloop);
+  pa_threaded_mainloop_unlock(s_mainloop);
+
+  if (!s_ok) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf),
+             "Failed to connect to PulseAudio server: %s",
+             pa_strerror(pa_context_errno(s_context)));
+    pa_threaded_mainloop_stop(s_mainloop);
+    return -1;
+  }
+
+  /* Match system byte order in sample format */
+  if (is_litte_endian_system()) {
+    s_default_sample_spec.format = PA_SAMPLE_FLOAT32LE;
+  } else {
+    s_default_sample_spec.format = PA_SAMPLE_FLOAT32BE;
+  }
+
+  atexit(cleanup);
+
+  return 0;
+}
+
+static void sink_info_list_callback(pa_context *context, const pa_sink_info *info,
+                                    int eol, void *userdata)
+{
+  (void) context;
+  (void) userdata;
+
+  const char *key;
+  const char *description;
+
+  if (eol) {
+    pa_threaded_mainloop_signal(s_mainloop, 0);
+    return;
+  }
+
+  key = PA_PROP_DEVICE_DESCRIPTION;
+  description = pa_proplist_gets(info->proplist, key);
+
+  struct list *l = xcalloc(1, sizeof(*l));
+  l->index = info->index;
+  l->name = strdup(info->name);
+  l->description = strdup(description);
+  l->next = s_list;
+  s_list = l;
+}
+
+static struct list *pulse_list_sinks(void)
+{
+  struct list *l;
+
+  pa_threaded_mainloop_lock(s_mainloop);
+  pa_context_get_sink_info_list(s_context, sink_info_list_callback, NULL);
+  pa_threaded_mainloop_wait(s_mainloop);
+  pa_threaded_mainloop_unlock(s_mainloop);
+
+  l = s_list;
+  s_list = NULL;
+return l;
+}
+
+static void stream_connect_callback(pa_stream *s, void *userdata)
+{
+  (void) userdata;
+  enum pa_stream_state state;
+
+  state = pa_stream_get_state(s);
+  switch (state)
+  {
+  case PA_STREAM_READY:
+    s_ok = 1;
+    __attribute__((fallthrough));
+  case PA_STREAM_FAILED:
+    pa_threaded_mainloop_signal(s_mainloop, 0);
+    break;
+  default:
+    break;
+  }
+}
+
+static int pulse_connect_sink(const char *name, const struct stream_settings *settings)
+{
+  s_default_sample_spec.rate = settings->samplerate;
+  s_default_sample_spec.channels = settings->channels;
+  s_latency = settings->latency * PA_USEC_PER_MSEC;
+
+  s_playback_stream = pa_stream_new(s_context, s_playback_stream_name, &s_default_sample_spec, NULL);
+  if (s_playback_stream == NULL) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf),
+             "Failed to create playback stream: %s",
+             pa_strerror(pa_context_errno(s_context)));
+    return -1;
+  }
+
+  /* Overwrite some buffer attributes
+   * so application is more responsive to
+   * configuration updates */
+  pa_buffer_attr attr = {
+    .fragsize = (uint32_t)-1,
+    .maxlength = (uint32_t)-1,
+    .minreq = (uint32_t)-1,
+    .prebuf = 0,
+    .tlength = pa_usec_to_bytes(DEFAULT_BUFFER_TIME, &s_default_sample_spec),
+  };
+
+  /* With a target latency, the server sizes its own
+   * buffers to match instead of adding to them */
+  pa_stream_flags_t flags = PA_STREAM_START_CORKED | PA_STREAM_INTERPOLATE_TIMING |
+                            PA_STREAM_AUTO_TIMING_UPDATE;
+  if (s_latency) {
+    attr.tlength = pa_usec_to_bytes(s_latency, &s_default_sample_spec);
+    flags |= PA_STREAM_ADJUST_LATENCY;
+  }
+  if (settings->minreq) {
+    attr.minreq = pa_usec_to_bytes(settings->minreq * PA_USEC_PER_MSEC, &s_default_sample_spec);
+  }
+
+  s_ok = 0;
+  pa_threaded_mainloop_lock(s_mainloop);
+  pa_stream_set_state_callback(s_playback_stream, stream_connect_callback, s_playback_stream);
+
+  /* Start stream in paused mode.
+   * Sync with record stream. */
+  pa_stream_connect_playback(s_playback_stream, name, &attr, flags, NULL, NULL);
+  pa_threaded_mainloop_wait(s_mainloop);
+
+  if (!s_ok) {
+    pa_threaded_mainloop_unlock(s_mainloop);
+    name = name ? name : "default sink";
+    snprintf(s_errorbuf, sizeof(s_errorbuf),
+             "Failed to connect to %s: %s",
+             name, pa_strerror(pa_context_errno(s_context)));
+    return -1;
+  }
+
+  /* The server may have picked other sizes */
+  const pa_buffer_attr *actual = pa_stream_get_buffer_attr(s_playback_stream);
+  s_max_request = actual->tlength;
+  s_min_request = actual->minreq;
+  log_info("Stream buffer: %.1f ms, minimum request %.1f ms",
+           (double) pa_bytes_to_usec(actual->tlength, &s_default_sample_spec) / PA_USEC_PER_MSEC,
+           (double) pa_bytes_to_usec(actual->minreq, &s_default_sample_spec) / PA_USEC_PER_MSEC);
+  pa_threaded_mainloop_unlock(s_mainloop);
+
+  return 0;
+}
+
+static const char *pulse_get_error_string(void)
+{
+  return s_errorbuf;
+}
+
+static void stream_success_callback(pa_stream *s, int ok, void *userdata)
+{
+  (void) s;
+  (void) userdata;
+  s_ok = ok;
+  s_op_done = 1;
+  pa_threaded_mainloop_signal(s_mainloop, 1);
+}
+
+/* Pause stream if b == 1, start if b == 0 */
+static int cork_stream(pa_stream *stream, int b)
+{
+  pa_operation *op;
+  enum pa_error_code err;
+
+  pa_threaded_mainloop_lock(s_mainloop);
+
+  s_ok = 0;
+  s_op_done = 0;
+  op = pa_stream_cork(stream, b, stream_success_callback, NULL);
+
+  while (!s_op_done) {
+    pa_threaded_mainloop_wait(s_mainloop);
+  }
+
+  pa_operation_unref(op);
+  pa_threaded_mainloop_accept(s_mainloop);
+  err = pa_context_errno(s_context);
+  pa_threaded_mainloop_unlock(s_mainloop);
+
+  if (s_ok)
+    return 0;
+
+  snprintf(s_errorbuf, sizeof(s_errorbuf),
+           "Failed to %s stream: %s",
+           b ? "stop" : "start", pa_strerror(err));
+  return -1;
+}
+
+/* Get a buffer of the stream to write up to *nsamps samples
+ * in to. *nsamps is set to the size of the buffer. Returns
+ * NULL if the stream has no buffer */
+static float *begin_write(pa_stream *s, size_t *nsamps)
+{
+  void *data;
+  size_t nbytes = *nsamps * sizeof(float);
+
+  if (pa_stream_begin_write(s, &data, &nbytes) < 0 || data == NULL) {
+    return NULL;
+  }
+
+  if (nbytes < sizeof(float)) {
+    pa_stream_cancel_write(s);
+    return NULL;
+  }
+
+  if (nbytes / sizeof(float) < *nsamps) {
+    *nsamps = nbytes / sizeof(float);
+  }
+
+  return data;
+}
+
+static void stream_write_callback(pa_stream *s, size_t nbytes, void *userdata)
+{
+  (void) userdata;
+  size_t nsamps = nbytes / sizeof(float);
+
+  /* Render straight in to the buffers of the stream */
+  while (nsamps) {
+    size_t length = nsamps;
+    float *out = begin_write(s, &length);
+    if (out == NULL) {
+      break;
+    }
+
+    fill_stream(out, length);
+    pa_stream_write(s, out, length * sizeof(float), NULL, 0, PA_SEEK_RELATIVE);
+    nsamps -= length;
+  }
+}
+
+/* Generic stream notification callback that just prints
+ * a messsage */
+static void stream_notify_callback(pa_stream *p, void *userdata)
+{
+  (void) p;
+  const char *msg = userdata;
+  log_warn_async("Stream notify: %s", msg);
+}
+
+/* Pick up the buffer sizes the server granted after the
+ * target latency was raised. The depth of the render-ahead
+ * ring stays as it was when the stream started */
+static void buffer_attr_callback(pa_stream *s, int success, void *userdata)
+{
+  (void) userdata;
+
+  if (!success) {
+    log_warn_async("Failed to raise target latency: %s",
+                   pa_strerror(pa_context_errno(s_context)));
+    return;
+  }
+
+  const pa_buffer_attr *actual = pa_stream_get_buffer_attr(s);
+  s_max_request = actual->tlength;
+  s_min_request = actual->minreq;
+
+  log_warn_async("Stream buffer: %.1f ms, minimum request %.1f ms",
+                 (double) pa_bytes_to_usec(actual->tlength, &s_default_sample_spec) / PA_USEC_PER_MSEC,
+                 (double) pa_bytes_to_usec(actual->minreq, &s_default_sample_spec) / PA_USEC_PER_MSEC);
+}
+
+/* Raise the target latency by half after repeated underflows,
+ * up to the default buffer length */
+static void stream_underflow_callback(pa_stream *p, void *userdata)
+{
+  stream_notify_callback(p, userdata);
+
+  if (!s_latency || ++s_underflows < UNDERFLOW_LIMIT) {
+    return;
+  }
+  s_underflows = 0;
+
+  pa_buffer_attr attr = *pa_stream_get_buffer_attr(p);
+  uint32_t max = pa_usec_to_bytes(DEFAULT_BUFFER_TIME, &s_default_sample_spec);
+  if (attr.tlength >= max) {
+    return;
+  }
+
+  attr.tlength = attr.tlength + attr.tlength / 2 < max ? attr.tlength + attr.tlength / 2 : max;
+  pa_operation *op = pa_stream_set_buffer_attr(p, &attr, buffer_attr_callback, NULL);
+  if (op) {
+    pa_operation_unref(op);
+  }
+
+  log_warn_async("Repeated underflows, asking for a target latency of %.1f ms",
+                 (double) pa_bytes_to_usec(attr.tlength, &s_default_sample_spec) / PA_USEC_PER_MSEC);
+}
+
+/* Report the measured latency of the stream */
+static void latency_timer_callback(pa_mainloop_api *api, pa_time_event *e,
+                                   const struct timeval *tv, void *userdata)
+{
+  (void) api;
+  (void) tv;
+  (void) userdata;
+  pa_usec_t latency;
+  int negative;
+
+  /* Audio rendered ahead adds to the latency of the stream */
+  if (pa_stream_get_latency(s_playback_stream, &latency, &negative) == 0) {
+    double ms = (negative ? -(double) latency : (double) latency) / PA_USEC_PER_MSEC;
+    log_info_async("Latency: %.1f ms", ms + (double) get_stream_source_delay() / 1000.);
+  }
+  s_underflows = 0;
+
+  pa_context_rttime_restart(s_context, e, pa_rtclock_now() + LATENCY_REPORT_INTERVAL);
+}
+
+static int pulse_start_stream(struct synthesizer *syn)
+{
+  if (open_stream_source(syn, s_max_request / sizeof(float), s_min_request / sizeof(float)) < 0) {
+    snprintf(s_errorbuf, sizeof(s_errorbuf), "Failed to start render thread");
+    return -1;
+  }
+
+  pa_stream_set_write_callback(s_playback_stream, stream_write_callback, NULL);
+
+  /* Set some notification callbacks */
+  pa_stream_set_overflow_callback(s_playback_stream, stream_notify_callback, "Overflow");
+  pa_stream_set_underflow_callback(s_playback_stream, stream_underflow_callback, "Underflow");
+  pa_stream_set_suspended_callback(s_playback_stream, stream_notify_callback, "Suspended");
+
+  if (cork_stream(s_playback_stream, 0) < 0)
+    return -1;
+
+  if (s_latency) {
+    pa_threaded_mainloop_lock(s_mainloop);
+    pa_context_rttime_new(s_context, pa_rtclock_now() + LATENCY_REPORT_INTERVAL,
+                          latency_timer_callback, NULL);
+    pa_threaded_mainloop_unlock(s_mainloop);
+  }
+
+  return 0;
+}
+
+static long pulse_get_delay(void)
+{
+  pa_usec_t latency;
+  int negative;
+  long delay = -1;
+
+  pa_threaded_mainloop_lock(s_mainloop);
+  if (s_playback_stream && pa_stream_get_latency(s_playback_stream, &latency, &negative) == 0) {
+    delay = negative ? 0 : (long) latency;
+  }
+  pa_threaded_mainloop_unlock(s_mainloop);
+
+  return delay;
+}
+
+const struct audio_backend pulse_backend = {
+  .name             = "pulse",
+  .init             = pulse_init,
+  .list_sinks       = pulse_list_sinks,
+  .connect_sink     = pulse_connect_sink,
+  .start_stream     = pulse_start_stream,
+  .get_delay        = pulse_get_delay,
+  .get_error_string = pulse_get_error_string,
+};
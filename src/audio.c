@@ -1,301 +1,196 @@
 #include <string.h>
-#include <stdio.h>
-#include <pulse/pulseaudio.h>
+#include <stdlib.h>
+#include <stdint.h>
 
-#include "log.h"
 #include "audio.h"
-#include "synthesizer.h"
+#include "audio-backend.h"
 #include "output.h"
-#include "xmalloc.h"
+#include "render-ahead.h"
+#include "rt-check.h"
 
-/* Names for publicly visible PulseAudio objects */
-static const char *s_application_name = "Anomi";
-static const char *s_playback_stream_name = "Anomi Output";
+static const struct audio_backend *s_backends[] = {
+  &pulse_backend,
+  &alsa_backend,
+  &null_backend,
+};
 
-static char s_errorbuf[512] = {0};
+static const struct audio_backend *s_backend = &pulse_backend;
 
-/* Status flag for callbacks that might fail */
-static int s_ok;
+static struct stream_settings s_settings;
 
-/* Status flag for running pa_operations */
-static int s_op_done;
+/* Render thread, NULL if rendering on the thread of the stream */
+static struct render_ahead *s_render_ahead = NULL;
+static size_t s_render_blocks = 0;
+static size_t s_render_size;           /* Samples in the ring */
+static int s_render_started = 0;       /* The first request was read */
+static int s_render_cpu = -1;
 
-/* PulseAudio objects */
-static pa_context *s_context;
-static pa_threaded_mainloop *s_mainloop;
-static pa_stream *s_playback_stream = NULL;
+static struct synthesizer *s_syn;
+static size_t s_max_length;
 
-/* List with sink/source info */
-static struct list *s_list;
+int select_audio_backend(const char *name)
+{
+  for (size_t i = 0; i < sizeof(s_backends) / sizeof(*s_backends); ++i) {
+    if (strcmp(s_backends[i]->name, name) == 0) {
+      s_backend = s_backends[i];
+      return 0;
+    }
+  }
 
-/* Default sample spec, overwritten
- * by match_audio_file_sample_spec */
-static pa_sample_spec s_default_sample_spec;
+  return -1;
+}
 
-static int is_litte_endian_system(void)
+const char *get_audio_backend_name(void)
 {
-  int x = 1;
-  return *(char*) &x == 1;
+  return s_backend->name;
 }
 
-static void context_connect_callback(pa_context *context, void *userdata)
+int init_audio(void)
 {
-  (void) context;
-  (void) userdata;
-  enum pa_context_state state;
-
-  state = pa_context_get_state(s_context);
-  switch (state) {
-  case PA_CONTEXT_READY:
-    s_ok = 1;
-    __attribute__((fallthrough));
-  case PA_CONTEXT_FAILED:
-    pa_threaded_mainloop_signal(s_mainloop, 0);
-    break;
-  default:
-    break;
-  }
+  return s_backend->init();
 }
 
-static void cleanup(void)
+struct list *list_sinks(void)
 {
-  /* TODO: syncing */
-
-  if (s_playback_stream) {
-    pa_stream_disconnect(s_playback_stream);
-  }
-
-  pa_context_disconnect(s_context);
-  pa_threaded_mainloop_stop(s_mainloop);
+  return s_backend->list_sinks();
 }
 
-int init_audio(void)
+void match_audio_file_sample_spec(struct audio_file *af)
 {
-  /* Start mainloop */
-  s_mainloop = pa_threaded_mainloop_new();
-  pa_mainloop_api *api = pa_threaded_mainloop_get_api(s_mainloop);
-  s_context = pa_context_new(api, s_application_name);
-  pa_threaded_mainloop_start(s_mainloop);
-
-  /* Connect to PulseAudio server */
-  s_ok = 0;
-  pa_threaded_mainloop_lock(s_mainloop);
-  pa_context_set_state_callback(s_context, context_connect_callback, NULL);
-  pa_context_connect(s_context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL);
-  pa_threaded_mainloop_wait(s_mainloop);
-  pa_threaded_mainloop_unlock(s_mainloop);
-
-  if (!s_ok) {
-    snprintf(s_errorbuf, sizeof(s_errorbuf),
-             "Failed to connect to PulseAudio server: %s",
-             pa_strerror(pa_context_errno(s_context)));
-    pa_threaded_mainloop_stop(s_mainloop);
-    return -1;
-  }
-
-  /* Match system byte order in sample format */
-  if (is_litte_endian_system()) {
-    s_default_sample_spec.format = PA_SAMPLE_FLOAT32LE;
-  } else {
-    s_default_sample_spec.format = PA_SAMPLE_FLOAT32BE;
-  }
-
-  atexit(cleanup);
-
-  return 0;
+  s_settings.samplerate = af->samplerate;
+  s_settings.channels = af->channels;
 }
 
-static void sink_info_list_callback(pa_context *context, const pa_sink_info *info,
-                                    int eol, void *userdata)
+void set_stream_latency(unsigned int latency, unsigned int minreq)
 {
-  (void) context;
-  (void) userdata;
-
-  const char *key;
-  const char *description;
-
-  if (eol) {
-    pa_threaded_mainloop_signal(s_mainloop, 0);
-    return;
-  }
-
-  key = PA_PROP_DEVICE_DESCRIPTION;
-  description = pa_proplist_gets(info->proplist, key);
-
-  struct list *l = xcalloc(1, sizeof(*l));
-  l->index = info->index;
-  l->name = strdup(info->name);
-  l->description = strdup(description);
-  l->next = s_list;
-  s_list = l;
+  s_settings.latency = latency;
+  s_settings.minreq = minreq;
 }
 
-struct list *list_sinks(void)
+int connect_sink(const char *name)
 {
-  struct list *l;
-
-  pa_threaded_mainloop_lock(s_mainloop);
-  pa_context_get_sink_info_list(s_context, sink_info_list_callback, NULL);
-  pa_threaded_mainloop_wait(s_mainloop);
-  pa_threaded_mainloop_unlock(s_mainloop);
-
-  l = s_list;
-  s_list = NULL;
-return l;
+  return s_backend->connect_sink(name, &s_settings);
 }
 
-static void stream_connect_callback(pa_stream *s, void *userdata)
+const char *get_audio_error_string(void)
 {
-  (void) userdata;
-  enum pa_stream_state state;
-
-  state = pa_stream_get_state(s);
-  switch (state)
-  {
-  case PA_STREAM_READY:
-    s_ok = 1;
-    __attribute__((fallthrough));
-  case PA_STREAM_FAILED:
-    pa_threaded_mainloop_signal(s_mainloop, 0);
-    break;
-  default:
-    break;
-  }
+  return s_backend->get_error_string();
 }
 
-void match_audio_file_sample_spec(struct audio_file *af)
+long get_stream_source_delay(void)
 {
-  s_default_sample_spec.rate = af->samplerate;
-  s_default_sample_spec.channels = af->channels;
+  if (!s_render_ahead) {
+    return 0;
+  }
+
+  uint64_t samples = render_ahead_available(s_render_ahead);
+  return (long) (samples * 1000000 / ((uint64_t) s_settings.samplerate * s_settings.channels));
 }
 
-int connect_sink(const char *name)
+long get_stream_delay(void)
 {
-  s_playback_stream = pa_stream_new(s_context, s_playback_stream_name, &s_default_sample_spec, NULL);
-  if (s_playback_stream == NULL) {
-    snprintf(s_errorbuf, sizeof(s_errorbuf),
-             "Failed to create playback stream: %s",
-             pa_strerror(pa_context_errno(s_context)));
-    return -1;
-  }
+  long delay = s_backend->get_delay();
 
-  /* Overwrite some buffer attributes
-   * so application is more responsive to
-   * configuration updates */
-  pa_buffer_attr attr = {
-    .fragsize = (uint32_t)-1,
-    .maxlength = (uint32_t)-1,
-    .minreq = (uint32_t)-1,
-    .prebuf = 0,
-    .tlength = pa_usec_to_bytes(1000000, &s_default_sample_spec),
-  };
-
-  s_ok = 0;
-  pa_threaded_mainloop_lock(s_mainloop);
-  pa_stream_set_state_callback(s_playback_stream, stream_connect_callback, s_playback_stream);
-
-  /* Start stream in paused mode.
-   * Sync with record stream. */
-  pa_stream_connect_playback(s_playback_stream, name, &attr, PA_STREAM_START_CORKED, NULL, NULL);
-  pa_threaded_mainloop_wait(s_mainloop);
-  pa_threaded_mainloop_unlock(s_mainloop);
-
-  if (!s_ok) {
-    name = name ? name : "default sink";
-    snprintf(s_errorbuf, sizeof(s_errorbuf),
-             "Failed to connect to %s: %s",
-             name, pa_strerror(pa_context_errno(s_context)));
-    return -1;
+  if (delay >= 0) {
+    delay += get_stream_source_delay();
   }
 
-  return 0;
+  return delay;
 }
 
-const char *get_audio_error_string(void)
+void set_render_ahead(size_t blocks, int cpu)
 {
-  return s_errorbuf;
+  s_render_blocks = blocks;
+  s_render_cpu = cpu;
 }
 
-static void stream_success_callback(pa_stream *s, int ok, void *userdata)
+int start_stream(struct synthesizer *syn)
 {
-  (void) s;
-  (void) userdata;
-  s_ok = ok;
-  s_op_done = 1;
-  pa_threaded_mainloop_signal(s_mainloop, 1);
+  return s_backend->start_stream(syn);
 }
 
-/* Pause stream if b == 1, start if b == 0 */
-static int cork_stream(pa_stream *stream, int b)
+int open_stream_source(struct synthesizer *syn, size_t max_request, size_t request)
 {
-  pa_operation *op;
-  enum pa_error_code err;
+  s_syn = syn;
 
-  pa_threaded_mainloop_lock(s_mainloop);
-
-  s_ok = 0;
-  s_op_done = 0;
-  op = pa_stream_cork(stream, b, stream_success_callback, NULL);
-
-  while (!s_op_done) {
-    pa_threaded_mainloop_wait(s_mainloop);
+  if (s_render_blocks) {
+    s_render_size = s_render_blocks * request;
+    s_render_ahead = create_render_ahead(syn, s_render_size, s_render_cpu);
+    if (s_render_ahead == NULL) {
+      return -1;
+    }
+  } else {
+    /* Allocate for the largest request up front,
+     * the stream must not allocate */
+    synthesizer_reserve(syn, max_request, 0);
   }
 
-  pa_operation_unref(op);
-  pa_threaded_mainloop_accept(s_mainloop);
-  err = pa_context_errno(s_context);
-  pa_threaded_mainloop_unlock(s_mainloop);
+  s_max_length = synthesizer_get_max_length(syn);
 
-  if (s_ok)
-    return 0;
-
-  snprintf(s_errorbuf, sizeof(s_errorbuf),
-           "Failed to %s stream: %s",
-           b ? "stop" : "start", pa_strerror(err));
-  return -1;
+  return 0;
 }
 
-static void stream_write_callback(pa_stream *s, size_t nbytes, void *userdata)
+void close_stream_source(void)
 {
-  struct synthesizer *syn = userdata;
-  size_t nsamps = nbytes / sizeof(float);
-
-  /* Synthesize enough samples to fill target buffer */
-  lock_synthesizer(syn);
-  synthesize(syn, nsamps);
-  void *data = synthesizer_get_data_ptr(syn);
-  write_to_output_file(data, nsamps);
-  pa_stream_write(s, data, nbytes, NULL, 0, PA_SEEK_RELATIVE);
-  unlock_synthesizer(syn);
-
-  /* TODO: Should the pa_operation be handled somehow? */
-  pa_stream_drain(s, NULL, NULL);
+  if (s_render_ahead) {
+    free_render_ahead(s_render_ahead);
+    s_render_ahead = NULL;
+  }
 }
 
-/* Generic stream notification callback that just prints
- * a messsage */
-static void stream_notify_callback(pa_stream *p, void *userdata)
-{
-  (void) p;
-  const char *msg = userdata;
-  log_warn("Stream notify: %s", msg);
+/* Copy rendered samples out of the render thread's ring */
+static void read_ahead(float *out, size_t n)
+{
+  /* Requests larger than the ring, filling the buffer of the
+   * stream when it starts or grows, are primed with silence
+   * up front rather than running the ring empty. Expected
+   * only for the first request */
+  if (n > s_render_size) {
+    if (s_render_started) {
+      render_ahead_underrun(s_render_ahead);
+    }
+    memset(out, 0, sizeof(*out) * (n - s_render_size));
+    out += n - s_render_size;
+    n = s_render_size;
+  }
+  s_render_started = 1;
+
+  for (size_t t = 0; t < n;) {
+    const float *data;
+    size_t length = render_ahead_peek(s_render_ahead, &data, n - t);
+
+    if (length == 0) {
+      /* Fill up with silence rather than leave the
+       * stream without data */
+      render_ahead_underrun(s_render_ahead);
+      memset(out + t, 0, sizeof(*out) * (n - t));
+      return;
+    }
+
+    memcpy(out + t, data, sizeof(*out) * length);
+    render_ahead_consume(s_render_ahead, length);
+    t += length;
+  }
 }
 
-int start_stream(struct synthesizer *syn)
+void fill_stream(float *out, size_t n)
 {
-  /* Set write callback and start streams */
-
-  pa_stream_set_write_callback(s_playback_stream, stream_write_callback, syn);
-
-  /* Set some notification callbacks */
-  pa_stream_set_overflow_callback(s_playback_stream, stream_notify_callback, "Overflow");
-  pa_stream_set_underflow_callback(s_playback_stream, stream_notify_callback, "Underflow");
-  pa_stream_set_suspended_callback(s_playback_stream, stream_notify_callback, "Suspended");
+  rt_enter();
 
-  if (cork_stream(s_playback_stream, 0) < 0)
-    return -1;
+  if (s_render_ahead) {
+    read_ahead(out, n);
+  } else {
+    /* Synthesize straight in to the buffer of the
+     * stream, in blocks the synthesizer has room for */
+    for (size_t t = 0; t < n;) {
+      size_t length = n - t < s_max_length ? n - t : s_max_length;
+      synthesize_into(s_syn, out + t, length);
+      write_to_output_file(out + t, length);
+      t += length;
+    }
+  }
 
-  return 0;
+  rt_leave();
 }
 
 void free_list(struct list *l)
@@ -12,6 +12,13 @@ struct list {
   struct list   *next;
 };
 
+/* Use the audio backend called name ("pulse", "alsa" or
+ * "null") instead of PulseAudio. Returns -1 if there is no
+ * such backend, must be called before init_audio */
+int select_audio_backend(const char *name);
+
+const char *get_audio_backend_name(void);
+
 int init_audio(void);
 
 struct list *list_sinks(void);
@@ -20,12 +27,32 @@ struct list *list_sinks(void);
  * of channels */
 void match_audio_file_sample_spec(struct audio_file *af);
 
+/* Ask for a stream latency and minimum request size in
+ * milliseconds, 0 leaves them to the defaults. With a target
+ * latency, the measured latency is reported periodically and
+ * repeated underflows raise the target. Must be called before
+ * connect_sink */
+void set_stream_latency(unsigned int latency, unsigned int minreq);
+
 int connect_sink(const char *name);
 
 const char *get_audio_error_string(void);
 
+/* Render on a thread of its own, up to blocks stream requests
+ * ahead of playback, pinned to cpu unless it is negative. A
+ * request is the minimum request or period of the stream, the
+ * depth is fixed when the stream starts. The stream then only
+ * copies. Disabled if blocks is 0, must be called before
+ * start_stream */
+void set_render_ahead(size_t blocks, int cpu);
+
 int start_stream(struct synthesizer *syn);
 
+/* Microseconds of audio rendered but not yet played, in the
+ * render thread's ring and the buffers of the backend. Returns
+ * -1 if the backend can't tell */
+long get_stream_delay(void);
+
 void free_list(struct list *l);
 
 #endif
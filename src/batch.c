@@ -0,0 +1,252 @@
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sndfile.h>
+
+#include "log.h"
+#include "xmalloc.h"
+#include "audio-file.h"
+#include "synthesizer.h"
+#include "batch.h"
+
+/* Frames synthesized at a time */
+#define BATCH_BLOCK 16384
+
+/* One (audio file, profile) pair */
+struct batch_job {
+  struct audio_file    *af;
+  size_t                profile;
+  char                 *output;
+};
+
+struct batch {
+  struct config                *cfg;
+  const struct batch_settings  *settings;
+  struct batch_job             *jobs;
+  size_t                        num_jobs;
+  atomic_size_t                 next;       /* Next job to be picked up */
+  atomic_size_t                 failed;
+};
+
+static double get_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* <outdir>/<file>-<index>[-<name>].wav, where file is the
+ * audio file name without directory and extension */
+static char *get_output_name(const char *outdir, const char *path,
+                             size_t index, const char *name)
+{
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+
+  const char *ext = strrchr(base, '.');
+  int length = ext && ext != base ? (int) (ext - base) : (int) strlen(base);
+
+  const char *sep = name ? "-" : "";
+  name = name ? name : "";
+
+  int size = snprintf(NULL, 0, "%s/%.*s-%zu%s%s.wav", outdir, length, base, index, sep, name);
+  char *output = xmalloc(size + 1);
+  snprintf(output, size + 1, "%s/%.*s-%zu%s%s.wav", outdir, length, base, index, sep, name);
+
+  /* Profile names may contain slashes */
+  for (char *c = output + strlen(outdir) + 1; *c; ++c) {
+    if (*c == '/') {
+      *c = '_';
+    }
+  }
+
+  return output;
+}
+
+static int run_job(struct batch *batch, struct batch_job *job)
+{
+  const struct batch_settings *settings = batch->settings;
+  struct audio_file *af = job->af;
+
+  SF_INFO info = {
+    .channels = af->channels,
+    .samplerate = af->samplerate,
+    .format = SF_FORMAT_PCM_24 | SF_FORMAT_WAV,
+  };
+
+  SNDFILE *file = sf_open(job->output, SFM_WRITE, &info);
+  if (file == NULL) {
+    log_err("Failed to open output file %s: %s", job->output, sf_strerror(NULL));
+    return -1;
+  }
+
+  /* Every job has a synthesizer of its own,
+   * the audio file is only read */
+  struct synthesizer *syn = create_synthesizer(af);
+  synthesizer_set_seed(syn, settings->seed);
+  set_synthesizer_profile(syn, &batch->cfg->profiles[job->profile], 1);
+
+  size_t block = (size_t) BATCH_BLOCK * af->channels;
+  synthesizer_reserve(syn, block, 0);
+
+  for (int pitch = 0; pitch < 12; ++pitch) {
+    if (settings->pitches & 1u << pitch) {
+      synthesizer_note_on(syn, pitch);
+    }
+  }
+
+  size_t total = (size_t) (settings->seconds * af->samplerate + .5) * af->channels;
+  double start = get_time();
+  int ret = 0;
+
+  for (size_t t = 0; t < total;) {
+    size_t length = total - t < block ? total - t : block;
+
+    synthesize(syn, length);
+    if (sf_write_float(file, synthesizer_get_data_ptr(syn), length) != (sf_count_t) length) {
+      log_err("Failed to write to %s: %s", job->output, sf_strerror(file));
+      ret = -1;
+      break;
+    }
+    t += length;
+  }
+
+  double elapsed = get_time() - start;
+
+  free_synthesizer(syn);
+  sf_close(file);
+
+  if (ret == 0) {
+    log_info("%s: %.1fx real time", job->output, elapsed > 0. ? settings->seconds / elapsed : 0.);
+  }
+
+  return ret;
+}
+
+/* Pick up jobs until there are none left */
+static void *batch_main(void *arg)
+{
+  struct batch *batch = arg;
+
+  for (;;) {
+    size_t i = atomic_fetch_add_explicit(&batch->next, 1, memory_order_relaxed);
+    if (i >= batch->num_jobs) {
+      break;
+    }
+
+    if (run_job(batch, &batch->jobs[i]) < 0) {
+      atomic_fetch_add_explicit(&batch->failed, 1, memory_order_relaxed);
+    }
+  }
+
+  return NULL;
+}
+
+int render_batch(struct config *cfg, const char **paths, size_t num_paths,
+                 const struct batch_settings *settings)
+{
+  struct audio_file *files = xcalloc(num_paths, sizeof(*files));
+  struct batch batch = {
+    .cfg = cfg,
+    .settings = settings,
+    .num_jobs = num_paths * cfg->size,
+  };
+  size_t loaded = 0;
+  int ret = -1;
+
+  batch.jobs = xcalloc(batch.num_jobs, sizeof(*batch.jobs));
+  atomic_init(&batch.next, 0);
+  atomic_init(&batch.failed, 0);
+
+  /* Decode every audio file once up front */
+  for (; loaded < num_paths; ++loaded) {
+    const char *err = load_audio_file(paths[loaded], &files[loaded]);
+    if (err != NULL) {
+      log_err("Failed to load audio file %s: %s", paths[loaded], err);
+      goto out;
+    }
+    log_info("Input file:    %s (%d channels, %d Hz)", paths[loaded],
+             files[loaded].channels, files[loaded].samplerate);
+  }
+
+  if (mkdir(settings->outdir, 0777) < 0 && errno != EEXIST) {
+    log_err("Failed to create output directory %s: %s", settings->outdir, strerror(errno));
+    goto out;
+  }
+
+  for (size_t i = 0; i < num_paths; ++i) {
+    for (size_t p = 0; p < cfg->size; ++p) {
+      struct batch_job *job = &batch.jobs[i * cfg->size + p];
+      struct stat st;
+
+      job->af = &files[i];
+      job->profile = p;
+      job->output = get_output_name(settings->outdir, paths[i], p, cfg->profiles[p].name);
+
+      if (!settings->overwrite && stat(job->output, &st) == 0) {
+        log_err("Output file %s already exists (overwrite with -y)", job->output);
+        goto out;
+      }
+    }
+  }
+
+  size_t threads = settings->threads;
+  if (threads == 0) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = n > 0 ? (size_t) n : 1;
+  }
+  if (threads > batch.num_jobs) {
+    threads = batch.num_jobs;
+  }
+
+  log_info("Rendering %zu jobs on %zu threads", batch.num_jobs, threads);
+  log_info("Seed:          %llu", (unsigned long long) settings->seed);
+
+  /* The calling thread picks up jobs as well */
+  pthread_t *workers = xcalloc(threads, sizeof(*workers));
+  size_t started = 0;
+  double start = get_time();
+
+  for (; started + 1 < threads; ++started) {
+    if (pthread_create(&workers[started], NULL, batch_main, &batch) != 0) {
+      log_warn("Failed to start batch thread, continuing on %zu threads", started + 1);
+      break;
+    }
+  }
+
+  batch_main(&batch);
+
+  for (size_t i = 0; i < started; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+
+  double elapsed = get_time() - start;
+  size_t failed = atomic_load(&batch.failed);
+  double rendered = settings->seconds * (batch.num_jobs - failed);
+
+  log_info("Rendered %zu of %zu jobs, %.1fs of audio in %.3fs, %.1fx real time",
+           batch.num_jobs - failed, batch.num_jobs, rendered, elapsed,
+           elapsed > 0. ? rendered / elapsed : 0.);
+
+  ret = (int) failed;
+
+out:
+  for (size_t i = 0; i < batch.num_jobs; ++i) {
+    free(batch.jobs[i].output);
+  }
+  free(batch.jobs);
+
+  for (size_t i = 0; i < loaded; ++i) {
+    free_audio_file(&files[i]);
+  }
+  free(files);
+
+  return ret;
+}
@@ -0,0 +1,25 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+struct batch_settings {
+  const char    *outdir;                 /* Directory the renders are written to */
+  double         seconds;                /* Length of each render */
+  unsigned int   pitches;                /* Mask of held pitch classes */
+  uint64_t       seed;
+  size_t         threads;                /* Jobs rendered at a time, 0 for one per CPU */
+  int            overwrite;              /* Replace existing renders */
+};
+
+/* Render every profile in cfg against every audio file in
+ * paths, each pair to <outdir>/<file>-<profile>.wav. The audio
+ * files are loaded once and shared by all jobs. Returns the
+ * number of failed jobs, or -1 if nothing was rendered */
+int render_batch(struct config *cfg, const char **paths, size_t num_paths,
+                 const struct batch_settings *settings);
+
+#endif
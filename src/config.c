@@ -31,6 +31,8 @@ static void default_profile(struct profile *profile)
   profile->max_multiplier      = 1.1892071150027212f;
   profile->reverse_probability = .1f;
   profile->num_slots           = 8;
+  profile->window              = WINDOW_TRIANGLE;
+  profile->interpolation       = INTERPOLATION_LINEAR;
 }
 
 /* Just load a text file in to a string */
@@ -124,6 +126,8 @@ static void warn_on_unknown_keys(cJSON *obj)
     "max_multiplier",
     "reverse_probability",
     "num_slots",
+    "window",
+    "interpolation",
     NULL,
   };
 
@@ -205,6 +209,32 @@ const char *load_config(const char *path, struct config *cfg)
       profile->name = strdup(item->valuestring);
     }
 
+    if ((item = cJSON_GetObjectItem(entry, "window"))) {
+      int window = cJSON_IsString(item) ? get_window_by_name(item->valuestring) : -1;
+      if (window < 0) {
+        snprintf(s_errorbuf, sizeof(s_errorbuf),
+                 "Attribute 'window' is not a known window");
+        cJSON_Delete(json);
+        free_config(cfg);
+        return s_errorbuf;
+      }
+
+      profile->window = window;
+    }
+
+    if ((item = cJSON_GetObjectItem(entry, "interpolation"))) {
+      int interpolation = cJSON_IsString(item) ? get_interpolation_by_name(item->valuestring) : -1;
+      if (interpolation < 0) {
+        snprintf(s_errorbuf, sizeof(s_errorbuf),
+                 "Attribute 'interpolation' is not a known interpolation");
+        cJSON_Delete(json);
+        free_config(cfg);
+        return s_errorbuf;
+      }
+
+      profile->interpolation = interpolation;
+    }
+
     /* Load values */
     LOAD_VALUE(entry, profile, level);
     LOAD_VALUE(entry, profile, min_offset);
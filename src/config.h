@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 
+#include "window.h"
+#include "interpolation.h"
+
 struct profile {
   char          *name;                   /* The name of this profile */
   float          level;                  /* The volume level where this profile is activated */
@@ -18,6 +21,8 @@ struct profile {
   float          max_multiplier;         /* Maximum time scaling factor */
   float          reverse_probability;    /* The probability that a single grain will be played back in reverse */
   unsigned int   num_slots;              /* The number of active grains */
+  enum window_type window;               /* Grain envelope shape */
+  enum interpolation interpolation;      /* Source interpolation when resampling grains */
 };
 
 /* List of configurations, this corresponds
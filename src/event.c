@@ -1,22 +1,31 @@
 #include <stdint.h>
-#include <string.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/eventfd.h>
 #include <assert.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <poll.h>
 
-#include "xmalloc.h"
+#include "log.h"
 #include "term.h"
 #include "watch.h"
 #include "event.h"
 
-struct event_queue {
-  struct event event;
-  struct event_queue *prev;
-  struct event_queue *next;
+/* Capacity of the event queue, a power of two. Events
+ * queued while it is full are dropped */
+#define EVENT_QUEUE_SIZE 1024
+
+/* Milliseconds between prints of messages queued by
+ * the audio thread while no events arrive */
+#define LOG_FLUSH_INTERVAL 100
+
+/* A cell is free for the producer claiming position p when
+ * its sequence is p, and holds an event for the consumer at
+ * position p when its sequence is p + 1 */
+struct event_cell {
+  atomic_size_t sequence;
+  struct event  event;
 };
 
 static struct pollfd s_pollfds[3];
@@ -25,13 +34,21 @@ static struct pollfd s_pollfds[3];
  * be handled by poll() */
 static int s_eventfd;
 
-/* Event queue */
-static struct event_queue *s_queue_front = NULL;
-static struct event_queue *s_queue_back = NULL;
+/* Bounded multi-producer single-consumer queue. Events are
+ * queued by the main loop and the MIDI thread, and only taken
+ * by the main loop */
+static struct event_cell s_queue[EVENT_QUEUE_SIZE];
+static atomic_size_t s_queue_tail;   /* Next position claimed by a producer */
+static size_t s_queue_head;          /* Next position read by the consumer */
 
-/* Guard the event queue since it's accessed
- * by the threaded PulseAudio mainloop */
-static pthread_mutex_t s_lock;
+/* Events left in the queue after the last wakeup */
+static int s_draining = 0;
+
+/* Queue statistics, reported by the consumer */
+static atomic_ulong s_dropped;
+static unsigned long s_reported_dropped = 0;
+static size_t s_high_water = 0;
+static size_t s_reported_high_water = EVENT_QUEUE_SIZE / 16;
 
 static void cleanup(void)
 {
@@ -53,9 +70,15 @@ const char *event_loop_start(const char *watch_path)
     return err;
   }
 
-  /* Set EFD_SEMAPHORE so eventfd counter matches
-   * length of event queue */
-  s_eventfd = eventfd(0, EFD_SEMAPHORE);
+  for (size_t i = 0; i < EVENT_QUEUE_SIZE; ++i) {
+    atomic_init(&s_queue[i].sequence, i);
+  }
+  atomic_init(&s_queue_tail, 0);
+  atomic_init(&s_dropped, 0);
+
+  /* The eventfd counter is only a wakeup, every
+   * wakeup drains the whole queue */
+  s_eventfd = eventfd(0, 0);
 
   /* Set file descriptors to poll */
   s_pollfds[0].fd = get_watch_descriptor();
@@ -70,72 +93,132 @@ const char *event_loop_start(const char *watch_path)
   return NULL;
 }
 
-struct event event_loop_poll(void)
+/* Take the oldest event off the queue. Returns 0 if
+ * the queue is empty, or the oldest event is still being
+ * written */
+static int dequeue_event(struct event *event)
 {
-  struct event event;
+  struct event_cell *cell = &s_queue[s_queue_head % EVENT_QUEUE_SIZE];
+
+  if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != s_queue_head + 1) {
+    return 0;
+  }
 
-  poll(s_pollfds, 3, -1);
+  *event = cell->event;
+  atomic_store_explicit(&cell->sequence, s_queue_head + EVENT_QUEUE_SIZE, memory_order_release);
+  s_queue_head++;
 
-  if (s_pollfds[0].revents & POLLIN) {
-    event.type = EVENT_WATCH;
+  return 1;
+}
 
-    /* Discard the contents of the inotify event */
-    consume_watch_event();
+/* Log dropped events and new high-water marks of the queue */
+static void report_queue_stats(void)
+{
+  size_t used = atomic_load_explicit(&s_queue_tail, memory_order_relaxed) - s_queue_head;
+  unsigned long dropped = atomic_load_explicit(&s_dropped, memory_order_relaxed);
 
-    return event;
+  if (used > s_high_water) {
+    s_high_water = used;
   }
 
-  if (s_pollfds[1].revents & POLLIN) {
-    event.type = EVENT_INPUT;
-    event.c = fgetc(stdin);
-    return event;
+  if (dropped != s_reported_dropped) {
+    log_warn("Event queue full, %lu events dropped", dropped - s_reported_dropped);
+    s_reported_dropped = dropped;
   }
 
-  if (s_pollfds[2].revents & POLLIN) {
-    pthread_mutex_lock(&s_lock);
+  /* Log once an eighth of the capacity is used,
+   * then every time the mark doubles */
+  if (s_high_water >= s_reported_high_water * 2) {
+    log_warn("Event queue high-water mark %zu of %d", s_high_water, EVENT_QUEUE_SIZE);
+    s_reported_high_water = s_high_water;
+  }
+}
 
-    assert(s_queue_front && "trying to read eventfd with no events in queue");
+struct event event_loop_poll(void)
+{
+  struct event event;
 
-    /* Discard the eventfd counter value */
-    uint64_t event_value;
+  for (;;) {
+    /* Events queued before the last wakeup are handled
+     * before polling again */
+    if (s_draining) {
+      if (dequeue_event(&event)) {
+        return event;
+      }
+      s_draining = 0;
+    }
+
+    int ready = poll(s_pollfds, 3, LOG_FLUSH_INTERVAL);
+
+    log_flush_async();
+    if (ready <= 0) {
+      continue;
+    }
+
+    if (s_pollfds[0].revents & POLLIN) {
+      event.type = EVENT_WATCH;
+
+      /* Discard the contents of the inotify event */
+      consume_watch_event();
+
+      return event;
+    }
+
+    if (s_pollfds[1].revents & POLLIN) {
+      event.type = EVENT_INPUT;
+      event.c = fgetc(stdin);
+      return event;
+    }
+
+    if (s_pollfds[2].revents & POLLIN) {
+      /* Reset the eventfd counter. Events queued from
+       * here on wake the next poll() */
+      uint64_t event_value;
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-result"
-    (void) read(s_eventfd, &event_value, sizeof(event_value));
+      (void) read(s_eventfd, &event_value, sizeof(event_value));
 #pragma GCC diagnostic pop
 
-    /* Pop event from queue */
-    memcpy(&event, &s_queue_front->event, sizeof(struct event));
-    struct event_queue *prev = s_queue_front->prev;
-    free(s_queue_front);
+      report_queue_stats();
 
-    if (s_queue_front == s_queue_back) {
-      s_queue_front = s_queue_back = NULL;
-    } else {
-      s_queue_front = prev;
+      /* The queue may already have been drained
+       * by the previous wakeup */
+      s_draining = 1;
+      continue;
     }
 
-    pthread_mutex_unlock(&s_lock);
-
-    return event;
+    assert(0 && "no events ready");
   }
-
-  assert(0 && "no events ready");
 }
 
 void queue_event(struct event *event)
 {
-  pthread_mutex_lock(&s_lock);
-
-  struct event_queue *eq = xcalloc(1, sizeof(*eq));
-  memcpy(&eq->event, event, sizeof(struct event));
-  if (s_queue_back == NULL) {
-    s_queue_back = s_queue_front = eq;
-  } else {
-    eq->next = s_queue_back;
-    s_queue_back->prev = eq;
-    s_queue_back = eq;
+  size_t pos = atomic_load_explicit(&s_queue_tail, memory_order_relaxed);
+  struct event_cell *cell;
+
+  /* Claim a free cell */
+  for (;;) {
+    cell = &s_queue[pos % EVENT_QUEUE_SIZE];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&s_queue_tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      /* The consumer hasn't freed the cell yet */
+      atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+      return;
+    } else {
+      pos = atomic_load_explicit(&s_queue_tail, memory_order_relaxed);
+    }
   }
 
+  cell->event = *event;
+  atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
   /* Update eventfd counter so the event is
    * detected in the poll() call */
   uint64_t event_value = 1;
@@ -143,6 +226,4 @@ void queue_event(struct event *event)
 #pragma GCC diagnostic ignored "-Wunused-result"
   (void) write(s_eventfd, &event_value, sizeof(event_value));
 #pragma GCC diagnostic pop
-
-  pthread_mutex_unlock(&s_lock);
 }
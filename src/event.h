@@ -1,11 +1,14 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+#include <stdint.h>
+
 enum event_type {
   EVENT_INPUT,    /* User pressed a key */
   EVENT_WATCH,    /* Config file was modified */
   EVENT_MIDI,
   EVENT_FREEZE,
+  EVENT_QUIT,     /* Leave the main loop */
 };
 
 struct event {
@@ -14,6 +17,8 @@ struct event {
   int pitch;              /* Midi event pitch class */
   int on;                 /* Midi on/off */
   int freeze;             /* Freeze synthesizer pitches */
+  uint64_t time;          /* Monotonic time in microseconds the event was made, for
+                           * measuring latency. 0 if not stamped */
 };
 
 const char *event_loop_start(const char *watch_path);
@@ -21,7 +26,9 @@ const char *event_loop_start(const char *watch_path);
 /* Poll for events */
 struct event event_loop_poll(void);
 
-/* Add an event to the event queue */
+/* Add an event to the event queue. Safe to call from any
+ * thread, never blocks. The event is dropped if the queue
+ * is full */
 void queue_event(struct event *event);
 
 #endif
@@ -0,0 +1,116 @@
+#include "log.h"
+#include "interpolation.h"
+#include "governor.h"
+
+/* Load above which quality is lowered, and below which it
+ * is restored */
+#define GOVERNOR_HIGH .75f
+#define GOVERNOR_LOW  .5f
+
+/* Weight of the latest block in the smoothed load */
+#define GOVERNOR_SMOOTHING .2f
+
+/* Load the slot limit is cut to when over the load range,
+ * assuming the load follows the number of slots. A single cut
+ * at most halves the limit */
+#define GOVERNOR_TARGET ((GOVERNOR_HIGH + GOVERNOR_LOW) / 2.f)
+#define GOVERNOR_MAX_CUT .5f
+#define GOVERNOR_MIN_LIMIT .05f
+
+/* Slot limit change per block while under the load range */
+#define GOVERNOR_INCREASE 1.02f
+
+/* Blocks to wait for the load to settle after an
+ * interpolation change. The wait grows with every change
+ * for the worse, so the governor doesn't keep flipping
+ * between two modes near the limit */
+#define GOVERNOR_HOLD        16
+#define GOVERNOR_MAX_BACKOFF 64
+
+void init_governor(struct governor *gov)
+{
+  gov->enabled = 0;
+  gov->load = 0.f;
+  gov->slot_limit = 1.f;
+  gov->interpolation = INTERPOLATION_COUNT - 1;
+  gov->hold = 0;
+  gov->backoff = 1;
+  gov->slot_hold = 0.f;
+  gov->settle_time = 0.f;
+  gov->logged_limit = 1.f;
+}
+
+void update_governor(struct governor *gov, double elapsed, double duration)
+{
+  if (!gov->enabled || duration <= 0.) {
+    return;
+  }
+
+  gov->load += ((float) (elapsed / duration) - gov->load) * GOVERNOR_SMOOTHING;
+
+  if (gov->hold) {
+    gov->hold--;
+  }
+
+  gov->slot_hold -= (float) duration;
+  if (gov->slot_hold < 0.f) {
+    gov->slot_hold = 0.f;
+  }
+
+  if (gov->load > GOVERNOR_HIGH) {
+    if (gov->interpolation > INTERPOLATION_LINEAR && gov->hold == 0) {
+      gov->interpolation--;
+      gov->hold = GOVERNOR_HOLD * gov->backoff;
+      if (gov->backoff < GOVERNOR_MAX_BACKOFF) {
+        gov->backoff *= 2;
+      }
+      log_warn_async("Governor: load %.0f%%, limiting interpolation to %s",
+                     gov->load * 100.f, get_interpolation_name(gov->interpolation));
+    } else if (gov->interpolation == INTERPOLATION_LINEAR && gov->slot_hold == 0.f) {
+      float cut = GOVERNOR_TARGET / gov->load;
+      gov->slot_limit *= cut > GOVERNOR_MAX_CUT ? cut : GOVERNOR_MAX_CUT;
+      if (gov->slot_limit < GOVERNOR_MIN_LIMIT) {
+        gov->slot_limit = GOVERNOR_MIN_LIMIT;
+      }
+
+      /* Dropped slots finish their grains first, and the
+       * smoothed load lags behind. Wait for both before
+       * judging the cut */
+      gov->slot_hold = gov->settle_time + GOVERNOR_HOLD * (float) duration;
+    }
+  } else if (gov->load < GOVERNOR_LOW) {
+    /* Plenty of headroom at full quality, changes
+     * are cheap again */
+    if (gov->load < GOVERNOR_LOW / 2.f && gov->slot_limit == 1.f &&
+        gov->interpolation == INTERPOLATION_COUNT - 1) {
+      gov->backoff = 1;
+    }
+
+    if (gov->slot_limit < 1.f) {
+      if (gov->slot_hold == 0.f) {
+        gov->slot_limit *= GOVERNOR_INCREASE;
+        if (gov->slot_limit > 1.f) {
+          gov->slot_limit = 1.f;
+        }
+      }
+    } else if (gov->interpolation < INTERPOLATION_COUNT - 1 && gov->hold == 0) {
+      gov->interpolation++;
+      gov->hold = GOVERNOR_HOLD;
+      log_info_async("Governor: load %.0f%%, allowing interpolation up to %s",
+                     gov->load * 100.f, get_interpolation_name(gov->interpolation));
+    }
+  }
+
+  /* Log slot limit changes in steps of 10% */
+  if (gov->slot_limit <= gov->logged_limit - .1f ||
+      gov->slot_limit >= gov->logged_limit + .1f ||
+      (gov->slot_limit == 1.f && gov->logged_limit != 1.f)) {
+    gov->logged_limit = gov->slot_limit;
+    if (gov->slot_limit < 1.f) {
+      log_warn_async("Governor: load %.0f%%, limiting slots to %.0f%%",
+                     gov->load * 100.f, gov->slot_limit * 100.f);
+    } else {
+      log_info_async("Governor: load %.0f%%, slots no longer limited", gov->load * 100.f);
+    }
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+/* Keeps rendering within the real-time budget. When the time
+ * spent rendering nears the duration of the rendered audio,
+ * the governor first falls back to cheaper interpolation, then
+ * lowers the number of slots. Quality is restored in reverse
+ * order once there is headroom again */
+struct governor {
+  int            enabled;
+  float          load;           /* Smoothed render time over block duration */
+  float          slot_limit;     /* Fraction of the profile slots rendered */
+  int            interpolation;  /* Most expensive interpolation allowed */
+  unsigned int   hold;           /* Blocks left before the interpolation changes again */
+  unsigned int   backoff;        /* Hold multiplier, doubled every time quality is lowered */
+  float          slot_hold;      /* Seconds left before the slot limit changes again */
+  float          settle_time;    /* Seconds grains play on after their slot is dropped,
+                                  * set by the caller */
+  float          logged_limit;   /* Slot limit last logged */
+};
+
+void init_governor(struct governor *gov);
+
+/* Update with the time in seconds spent rendering a block
+ * of duration seconds. Logs its decisions with log_*_async */
+void update_governor(struct governor *gov, double elapsed, double duration);
+
+#endif
@@ -0,0 +1,370 @@
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "xmalloc.h"
+#include "grain-cache.h"
+
+#define GRAIN_CACHE_BUCKETS 4096
+
+/* Entries in the pool */
+#define GRAIN_CACHE_ENTRIES 4096
+
+/* Capacity of the queue of missed grains, a power of two.
+ * Misses queued while it is full are not rendered */
+#define GRAIN_CACHE_QUEUE_SIZE 256
+
+/* Entries a lookup visits before giving up. Chains are
+ * changed under the feet of lookups, so a lookup may wander
+ * off in to another chain and miss */
+#define GRAIN_CACHE_MAX_VISITS 64
+
+/* Set in refs while the entry is not in use, or being
+ * changed by the fill thread */
+#define ENTRY_DEAD (1u << 31)
+
+/* A cell is free for the producer claiming position p when
+ * its sequence is p, and holds a key for the fill thread at
+ * position p when its sequence is p + 1 */
+struct grain_request {
+  atomic_size_t     sequence;
+  struct grain_key  key;
+};
+
+struct grain_cache {
+  _Atomic(struct grain_cache_entry *)  buckets[GRAIN_CACHE_BUCKETS];
+  struct grain_cache_entry            *entries;       /* Pool */
+  struct grain_cache_entry           **unused;        /* Entries of the pool not listed */
+  size_t                               num_unused;
+  size_t                               max_bytes;
+
+  grain_render_fn                      render;
+  void                                *arg;
+
+  /* Misses queued by the audio threads for the fill
+   * thread. Multiple producers, single consumer */
+  struct grain_request                 queue[GRAIN_CACHE_QUEUE_SIZE];
+  atomic_size_t                        queue_tail;
+  size_t                               queue_head;
+  sem_t                                wake;          /* Posted for every queued miss */
+  atomic_int                           quit;
+  pthread_t                            thread;
+
+  atomic_ulong                         hits;
+  atomic_ulong                         misses;
+  atomic_ulong                         evictions;
+  atomic_ulong                         dropped;
+  atomic_size_t                        num_entries;
+  atomic_size_t                        bytes;
+};
+
+static uint64_t mix64(uint64_t h, uint64_t x)
+{
+  h ^= x + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+  h ^= h >> 31;
+  h *= 0xbf58476d1ce4e5b9;
+  return h ^ (h >> 29);
+}
+
+static uint64_t hash_key(const struct grain_key *key)
+{
+  uint64_t h = 0;
+
+  h = mix64(h, key->offset);
+  h = mix64(h, key->length);
+  h = mix64(h, key->step);
+  h = mix64(h, (uint64_t) key->level << 8 | (uint64_t) key->reverse << 4 | (uint64_t) key->kernel);
+  h = mix64(h, (uint64_t) (uintptr_t) key->window);
+
+  return h;
+}
+
+static int key_equal(const struct grain_key *a, const struct grain_key *b)
+{
+  return a->offset == b->offset && a->length == b->length && a->step == b->step &&
+         a->level == b->level && a->reverse == b->reverse && a->kernel == b->kernel &&
+         a->window == b->window;
+}
+
+static size_t entry_bytes(unsigned int length)
+{
+  return sizeof(float) * length;
+}
+
+/* Queue a missed grain for the fill thread */
+static void request_grain(struct grain_cache *cache, const struct grain_key *key)
+{
+  size_t pos = atomic_load_explicit(&cache->queue_tail, memory_order_relaxed);
+  struct grain_request *request;
+
+  for (;;) {
+    request = &cache->queue[pos % GRAIN_CACHE_QUEUE_SIZE];
+    size_t sequence = atomic_load_explicit(&request->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&cache->queue_tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      /* Full */
+      atomic_fetch_add_explicit(&cache->dropped, 1, memory_order_relaxed);
+      return;
+    } else {
+      pos = atomic_load_explicit(&cache->queue_tail, memory_order_relaxed);
+    }
+  }
+
+  request->key = *key;
+  atomic_store_explicit(&request->sequence, pos + 1, memory_order_release);
+
+  sem_post(&cache->wake);
+}
+
+/* Take the oldest missed grain off the queue. Returns 0 if
+ * the queue is empty, or the oldest miss is still being
+ * written */
+static int dequeue_request(struct grain_cache *cache, struct grain_key *key)
+{
+  struct grain_request *request = &cache->queue[cache->queue_head % GRAIN_CACHE_QUEUE_SIZE];
+
+  if (atomic_load_explicit(&request->sequence, memory_order_acquire) != cache->queue_head + 1) {
+    return 0;
+  }
+
+  *key = request->key;
+  atomic_store_explicit(&request->sequence, cache->queue_head + GRAIN_CACHE_QUEUE_SIZE,
+                        memory_order_release);
+  cache->queue_head++;
+
+  return 1;
+}
+
+/* Find a listed entry, only for the fill thread */
+static struct grain_cache_entry *find_entry(struct grain_cache *cache,
+                                            const struct grain_key *key, uint64_t hash)
+{
+  struct grain_cache_entry *entry = atomic_load_explicit(&cache->buckets[hash % GRAIN_CACHE_BUCKETS],
+                                                         memory_order_relaxed);
+
+  for (; entry; entry = atomic_load_explicit(&entry->next, memory_order_relaxed)) {
+    if (atomic_load_explicit(&entry->hash, memory_order_relaxed) == hash &&
+        key_equal(&entry->key, key)) {
+      break;
+    }
+  }
+
+  return entry;
+}
+
+/* Evict the least recently used entry nobody plays.
+ * Returns -1 if every entry is played */
+static int evict_entry(struct grain_cache *cache)
+{
+  for (;;) {
+    struct grain_cache_entry *victim = NULL;
+    unsigned long oldest = 0;
+
+    for (size_t i = 0; i < GRAIN_CACHE_ENTRIES; ++i) {
+      struct grain_cache_entry *entry = &cache->entries[i];
+      unsigned long used = atomic_load_explicit(&entry->used, memory_order_relaxed);
+
+      if (entry->listed && atomic_load_explicit(&entry->refs, memory_order_relaxed) == 0 &&
+          (!victim || used < oldest)) {
+        victim = entry;
+        oldest = used;
+      }
+    }
+
+    if (!victim) {
+      return -1;
+    }
+
+    /* Lookups holding on to the entry from here on back off */
+    unsigned int refs = 0;
+    if (!atomic_compare_exchange_strong_explicit(&victim->refs, &refs, ENTRY_DEAD,
+                                                 memory_order_acquire, memory_order_relaxed)) {
+      continue;
+    }
+
+    /* Unlink it, its own link is left for lookups passing by */
+    uint64_t hash = atomic_load_explicit(&victim->hash, memory_order_relaxed);
+    _Atomic(struct grain_cache_entry *) *link = &cache->buckets[hash % GRAIN_CACHE_BUCKETS];
+    while (atomic_load_explicit(link, memory_order_relaxed) != victim) {
+      link = &atomic_load_explicit(link, memory_order_relaxed)->next;
+    }
+    atomic_store_explicit(link, atomic_load_explicit(&victim->next, memory_order_relaxed),
+                          memory_order_release);
+
+    victim->listed = 0;
+    free(victim->data);
+    victim->data = NULL;
+    cache->unused[cache->num_unused++] = victim;
+    atomic_fetch_sub_explicit(&cache->bytes, entry_bytes(victim->key.length), memory_order_relaxed);
+    atomic_fetch_sub_explicit(&cache->num_entries, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&cache->evictions, 1, memory_order_relaxed);
+
+    return 0;
+  }
+}
+
+/* Render a missed grain in to an entry of the pool and list it */
+static void fill_entry(struct grain_cache *cache, const struct grain_key *key)
+{
+  uint64_t hash = hash_key(key);
+  size_t bytes = entry_bytes(key->length);
+
+  /* Misses of the same grain are queued until it is listed */
+  if (find_entry(cache, key, hash) || bytes > cache->max_bytes) {
+    return;
+  }
+
+  while (cache->num_unused == 0 ||
+         atomic_load_explicit(&cache->bytes, memory_order_relaxed) + bytes > cache->max_bytes) {
+    if (evict_entry(cache) < 0) {
+      atomic_fetch_add_explicit(&cache->dropped, 1, memory_order_relaxed);
+      return;
+    }
+  }
+
+  struct grain_cache_entry *entry = cache->unused[--cache->num_unused];
+
+  entry->data = xmalloc(bytes);
+  entry->key = *key;
+  atomic_store_explicit(&entry->hash, hash, memory_order_relaxed);
+  atomic_store_explicit(&entry->used, atomic_load_explicit(&cache->hits, memory_order_relaxed),
+                        memory_order_relaxed);
+  cache->render(cache->arg, key, entry->data);
+
+  _Atomic(struct grain_cache_entry *) *bucket = &cache->buckets[hash % GRAIN_CACHE_BUCKETS];
+  atomic_store_explicit(&entry->next, atomic_load_explicit(bucket, memory_order_relaxed),
+                        memory_order_relaxed);
+  atomic_store_explicit(bucket, entry, memory_order_release);
+  entry->listed = 1;
+
+  atomic_fetch_add_explicit(&cache->bytes, bytes, memory_order_relaxed);
+  atomic_fetch_add_explicit(&cache->num_entries, 1, memory_order_relaxed);
+
+  /* Lookups see the key and data once the bit is cleared */
+  atomic_fetch_sub_explicit(&entry->refs, ENTRY_DEAD, memory_order_release);
+}
+
+/* Render missed grains as they are queued, at normal priority */
+static void *fill_main(void *arg)
+{
+  struct grain_cache *cache = arg;
+  struct grain_key key;
+
+  for (;;) {
+    while (sem_wait(&cache->wake) < 0 && errno == EINTR);
+
+    if (atomic_load_explicit(&cache->quit, memory_order_relaxed)) {
+      break;
+    }
+
+    /* A wakeup may find the miss it was posted for behind
+     * one still being queued, or taken by an earlier one */
+    while (dequeue_request(cache, &key)) {
+      fill_entry(cache, &key);
+    }
+  }
+
+  return NULL;
+}
+
+struct grain_cache *create_grain_cache(size_t max_bytes, grain_render_fn render, void *arg)
+{
+  struct grain_cache *cache = xcalloc(1, sizeof(*cache));
+
+  cache->max_bytes = max_bytes;
+  cache->render = render;
+  cache->arg = arg;
+
+  cache->entries = xcalloc(GRAIN_CACHE_ENTRIES, sizeof(*cache->entries));
+  cache->unused = xcalloc(GRAIN_CACHE_ENTRIES, sizeof(*cache->unused));
+  for (size_t i = 0; i < GRAIN_CACHE_ENTRIES; ++i) {
+    atomic_init(&cache->entries[i].refs, ENTRY_DEAD);
+    cache->unused[cache->num_unused++] = &cache->entries[GRAIN_CACHE_ENTRIES - 1 - i];
+  }
+
+  for (size_t i = 0; i < GRAIN_CACHE_QUEUE_SIZE; ++i) {
+    atomic_init(&cache->queue[i].sequence, i);
+  }
+
+  sem_init(&cache->wake, 0, 0);
+  atomic_init(&cache->quit, 0);
+
+  if (pthread_create(&cache->thread, NULL, fill_main, cache) != 0) {
+    sem_destroy(&cache->wake);
+    free(cache->unused);
+    free(cache->entries);
+    free(cache);
+    return NULL;
+  }
+
+  return cache;
+}
+
+void free_grain_cache(struct grain_cache *cache)
+{
+  atomic_store_explicit(&cache->quit, 1, memory_order_relaxed);
+  sem_post(&cache->wake);
+  pthread_join(cache->thread, NULL);
+  sem_destroy(&cache->wake);
+
+  for (size_t i = 0; i < GRAIN_CACHE_ENTRIES; ++i) {
+    free(cache->entries[i].data);
+  }
+
+  free(cache->unused);
+  free(cache->entries);
+  free(cache);
+}
+
+struct grain_cache_entry *grain_cache_get(struct grain_cache *cache, const struct grain_key *key)
+{
+  uint64_t hash = hash_key(key);
+  struct grain_cache_entry *entry = atomic_load_explicit(&cache->buckets[hash % GRAIN_CACHE_BUCKETS],
+                                                         memory_order_acquire);
+
+  for (int visits = 0; entry && visits < GRAIN_CACHE_MAX_VISITS; ++visits) {
+    if (atomic_load_explicit(&entry->hash, memory_order_relaxed) == hash) {
+      /* Holding on to the entry keeps its key and data
+       * from changing, unless it was dead already */
+      unsigned int refs = atomic_fetch_add_explicit(&entry->refs, 1, memory_order_acquire);
+
+      if (!(refs & ENTRY_DEAD) && key_equal(&entry->key, key)) {
+        unsigned long hits = atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+        atomic_store_explicit(&entry->used, hits, memory_order_relaxed);
+        return entry;
+      }
+
+      atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_release);
+    }
+
+    entry = atomic_load_explicit(&entry->next, memory_order_acquire);
+  }
+
+  atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+  request_grain(cache, key);
+
+  return NULL;
+}
+
+void grain_cache_release(struct grain_cache *cache, struct grain_cache_entry *entry)
+{
+  (void) cache;
+  atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_release);
+}
+
+void get_grain_cache_stats(struct grain_cache *cache, struct grain_cache_stats *stats)
+{
+  stats->hits = atomic_load_explicit(&cache->hits, memory_order_relaxed);
+  stats->misses = atomic_load_explicit(&cache->misses, memory_order_relaxed);
+  stats->evictions = atomic_load_explicit(&cache->evictions, memory_order_relaxed);
+  stats->dropped = atomic_load_explicit(&cache->dropped, memory_order_relaxed);
+  stats->entries = atomic_load_explicit(&cache->num_entries, memory_order_relaxed);
+  stats->bytes = atomic_load_explicit(&cache->bytes, memory_order_relaxed);
+}
@@ -0,0 +1,64 @@
+#ifndef GRAIN_CACHE_H
+#define GRAIN_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Everything that determines the waveform of a grain at
+ * unity gain */
+struct grain_key {
+  unsigned int   offset;       /* Absolute offset, quantized */
+  unsigned int   length;
+  uint64_t       step;
+  int            level;
+  int            reverse;
+  int            kernel;
+  const float   *window;
+};
+
+/* Entries come from a pool allocated with the cache. Only the
+ * fill thread changes them, while it holds the dead bit of refs */
+struct grain_cache_entry {
+  struct grain_key                     key;
+  _Atomic uint64_t                     hash;
+  atomic_uint                          refs;      /* Grains playing the entry, it's never evicted while > 0 */
+  atomic_ulong                         used;      /* Hit count of the cache at the last hit */
+  _Atomic(struct grain_cache_entry *)  next;      /* Hash chain */
+  int                                  listed;    /* In a hash chain */
+  float                               *data;      /* key.length samples */
+};
+
+struct grain_cache_stats {
+  unsigned long  hits;
+  unsigned long  misses;
+  unsigned long  evictions;
+  unsigned long  dropped;      /* Misses not rendered, the queue was full or no entry could be evicted */
+  size_t         entries;
+  size_t         bytes;
+};
+
+/* Render a grain at unity gain in to data, key->length samples */
+typedef void (*grain_render_fn)(void *arg, const struct grain_key *key, float *data);
+
+struct grain_cache;
+
+/* Create a cache holding at most max_bytes of grains, and the
+ * thread rendering missed grains with render. Returns NULL if
+ * the thread could not be started */
+struct grain_cache *create_grain_cache(size_t max_bytes, grain_render_fn render, void *arg);
+
+void free_grain_cache(struct grain_cache *cache);
+
+/* Look up a grain and hold on to it. On a miss, returns NULL
+ * and queues the grain for the fill thread, the caller plays
+ * it uncached. Never blocks or allocates, safe to call from
+ * any number of audio threads */
+struct grain_cache_entry *grain_cache_get(struct grain_cache *cache, const struct grain_key *key);
+
+/* Let go of an entry from grain_cache_get */
+void grain_cache_release(struct grain_cache *cache, struct grain_cache_entry *entry);
+
+void get_grain_cache_stats(struct grain_cache *cache, struct grain_cache_stats *stats);
+
+#endif
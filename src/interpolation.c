@@ -0,0 +1,70 @@
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "interpolation.h"
+
+static const char *s_names[INTERPOLATION_COUNT] = {
+  [INTERPOLATION_LINEAR] = "linear",
+  [INTERPOLATION_CUBIC]  = "cubic",
+  [INTERPOLATION_SINC]   = "sinc",
+};
+
+/* Cutoff relative to the Nyquist frequency, a bit below 1
+ * so the short kernel has room for its transition band */
+static const double s_cutoff = .9;
+
+static float s_sinc_table[(SINC_PHASES + 1) * SINC_TAPS];
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+
+static void build_sinc_table(void)
+{
+  const double pi = 3.14159265358979323846;
+  const double half = SINC_TAPS / 2;
+
+  for (int phase = 0; phase <= SINC_PHASES; ++phase) {
+    double frac = (double) phase / SINC_PHASES;
+    double sum = 0.;
+    float *row = &s_sinc_table[phase * SINC_TAPS];
+
+    for (int tap = 0; tap < SINC_TAPS; ++tap) {
+      /* Distance from the interpolated point to this tap */
+      double x = (double) (tap - INTERPOLATION_LEFT) - frac;
+      double sinc = x == 0. ? 1. : sin(pi * s_cutoff * x) / (pi * s_cutoff * x);
+
+      /* Blackman window over the kernel span */
+      double w = (x + half) / (2. * half);
+      double window = .42 - .5 * cos(2. * pi * w) + .08 * cos(4. * pi * w);
+
+      row[tap] = (float) (sinc * window);
+      sum += row[tap];
+    }
+
+    /* Normalize for unity gain at DC */
+    for (int tap = 0; tap < SINC_TAPS; ++tap) {
+      row[tap] = (float) (row[tap] / sum);
+    }
+  }
+}
+
+const float *get_sinc_table(void)
+{
+  pthread_once(&s_once, build_sinc_table);
+  return s_sinc_table;
+}
+
+int get_interpolation_by_name(const char *name)
+{
+  for (int interpolation = 0; interpolation < INTERPOLATION_COUNT; ++interpolation) {
+    if (strcmp(name, s_names[interpolation]) == 0) {
+      return interpolation;
+    }
+  }
+
+  return -1;
+}
+
+const char *get_interpolation_name(enum interpolation interpolation)
+{
+  return s_names[interpolation];
+}
@@ -0,0 +1,34 @@
+#ifndef INTERPOLATION_H
+#define INTERPOLATION_H
+
+/* Windowed sinc interpolation uses SINC_TAPS source samples,
+ * from position - SINC_TAPS / 2 + 1 to position + SINC_TAPS / 2.
+ * Coefficients are tabulated for 2^SINC_BITS fractional positions */
+#define SINC_TAPS 8
+#define SINC_BITS 9
+#define SINC_PHASES (1 << SINC_BITS)
+
+/* Number of source samples read before and after the integer
+ * position, for the widest interpolation */
+#define INTERPOLATION_LEFT  (SINC_TAPS / 2 - 1)
+#define INTERPOLATION_RIGHT (SINC_TAPS / 2)
+
+/* Source interpolation used when resampling grains */
+enum interpolation {
+  INTERPOLATION_LINEAR,
+  INTERPOLATION_CUBIC,    /* 4-point cubic Hermite */
+  INTERPOLATION_SINC,     /* Polyphase windowed sinc */
+  INTERPOLATION_COUNT,
+};
+
+/* Get the sinc coefficient table. Has SINC_PHASES + 1 rows of
+ * SINC_TAPS coefficients, built on first use */
+const float *get_sinc_table(void);
+
+/* Look up an interpolation by name in the configuration file.
+ * Returns -1 if there is no such interpolation */
+int get_interpolation_by_name(const char *name);
+
+const char *get_interpolation_name(enum interpolation interpolation);
+
+#endif
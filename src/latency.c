@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "log.h"
+#include "xmalloc.h"
+#include "audio.h"
+#include "latency.h"
+
+/* Pitch class toggled by the test */
+#define LATENCY_PITCH 0
+
+/* Pause between events in milliseconds, random so events
+ * land at every point of the blocks */
+#define LATENCY_MIN_PAUSE 50
+#define LATENCY_MAX_PAUSE 150
+
+/* Microseconds an event may take to reach a block
+ * before it is counted as lost */
+#define LATENCY_TIMEOUT 1000000
+
+/* Microseconds between polls of the synthesizer */
+#define LATENCY_POLL_INTERVAL 100
+
+struct latency_test {
+  struct synthesizer   *syn;
+  size_t                count;
+  double               *dispatch;       /* Milliseconds, per stage and event */
+  double               *block;
+  double               *output;
+  size_t                num_dispatch;
+  size_t                num_block;
+  size_t                num_output;
+  size_t                lost;
+  pthread_t             thread;
+};
+
+static struct latency_test s_test;
+
+/* Stamp of the event waiting to be handled, 0 if none,
+ * and when the main loop handled it */
+static _Atomic uint64_t s_pending;
+static _Atomic uint64_t s_handled;
+
+static uint64_t get_time_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static void sleep_us(long us)
+{
+  struct timespec ts = {
+    .tv_sec = us / 1000000,
+    .tv_nsec = us % 1000000 * 1000,
+  };
+  nanosleep(&ts, NULL);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static void report(const char *stage, double *ms, size_t n)
+{
+  if (n == 0) {
+    log_info("%-9s no measurements", stage);
+    return;
+  }
+
+  qsort(ms, n, sizeof(*ms), compare_double);
+
+  double sum = 0.;
+  for (size_t i = 0; i < n; ++i) {
+    sum += ms[i];
+  }
+
+  log_info("%-9s min %7.2f  p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f  mean %7.2f ms",
+           stage, ms[0], ms[(n - 1) / 2], ms[(size_t) ((n - 1) * .9)],
+           ms[(size_t) ((n - 1) * .99)], ms[n - 1], sum / n);
+}
+
+/* Queue one event and wait for the first block playing it */
+static void measure(struct latency_test *test, int on)
+{
+  uint64_t time = 0;
+  unsigned int pitches;
+
+  /* Only changes after this one count */
+  synthesizer_get_pitch_change(test->syn, &time, &pitches);
+  uint64_t last = time;
+
+  struct event ev = {
+    .type = EVENT_MIDI,
+    .pitch = LATENCY_PITCH,
+    .on = on,
+    .time = get_time_us(),
+  };
+
+  atomic_store(&s_handled, 0);
+  atomic_store(&s_pending, ev.time);
+  queue_event(&ev);
+
+  int found = 0;
+
+  while (get_time_us() - ev.time < LATENCY_TIMEOUT) {
+    if (synthesizer_get_pitch_change(test->syn, &time, &pitches) == 0 &&
+        time != last && !!(pitches & 1u << LATENCY_PITCH) == on) {
+      found = 1;
+      break;
+    }
+    sleep_us(LATENCY_POLL_INTERVAL);
+  }
+
+  /* The audio buffered now is about what was buffered
+   * ahead of the block when it was rendered */
+  long delay = get_stream_delay();
+  uint64_t handled = atomic_load(&s_handled);
+  atomic_store(&s_pending, 0);
+
+  if (handled) {
+    test->dispatch[test->num_dispatch++] = (double) (handled - ev.time) / 1000.;
+  }
+
+  if (!found) {
+    test->lost++;
+    return;
+  }
+
+  /* The block may have started just before the
+   * pitches were read */
+  double block = time > ev.time ? (double) (time - ev.time) / 1000. : 0.;
+  test->block[test->num_block++] = block;
+
+  if (delay >= 0) {
+    test->output[test->num_output++] = block + (double) delay / 1000.;
+  }
+}
+
+static void *latency_main(void *arg)
+{
+  struct latency_test *test = arg;
+  uint32_t state = 1;
+  int on = 0;
+
+  for (size_t i = 0; i < test->count; ++i) {
+    state = state * 1664525u + 1013904223u;
+    sleep_us((LATENCY_MIN_PAUSE + (long) (state >> 8) % (LATENCY_MAX_PAUSE - LATENCY_MIN_PAUSE)) * 1000);
+
+    on = !on;
+    measure(test, on);
+  }
+
+  log_info("Control latency over %zu events, %zu lost:", test->count, test->lost);
+  report("dispatch", test->dispatch, test->num_dispatch);
+  report("block", test->block, test->num_block);
+  report("output", test->output, test->num_output);
+  if (test->num_output < test->num_block) {
+    log_warn("The audio backend doesn't report its buffering, output latency is incomplete");
+  }
+
+  free(test->dispatch);
+  free(test->block);
+  free(test->output);
+
+  struct event quit = { .type = EVENT_QUIT, };
+  queue_event(&quit);
+
+  return NULL;
+}
+
+int start_latency_test(struct synthesizer *syn, size_t count)
+{
+  struct latency_test *test = &s_test;
+
+  test->syn = syn;
+  test->count = count;
+  test->dispatch = xcalloc(count, sizeof(*test->dispatch));
+  test->block = xcalloc(count, sizeof(*test->block));
+  test->output = xcalloc(count, sizeof(*test->output));
+  atomic_init(&s_pending, 0);
+  atomic_init(&s_handled, 0);
+
+  if (pthread_create(&test->thread, NULL, latency_main, test) != 0) {
+    free(test->dispatch);
+    free(test->block);
+    free(test->output);
+    return -1;
+  }
+  pthread_detach(test->thread);
+
+  return 0;
+}
+
+void latency_event_handled(const struct event *ev)
+{
+  uint64_t pending = atomic_load(&s_pending);
+
+  if (pending && ev->time == pending) {
+    atomic_store(&s_handled, get_time_us());
+  }
+}
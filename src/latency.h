@@ -0,0 +1,27 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+
+#include "event.h"
+#include "synthesizer.h"
+
+/* End-to-end control latency test. A thread toggles a pitch
+ * class through queue_event at random intervals, like a MIDI
+ * note would, and waits for the change to reach the output.
+ * For every event it measures the time from queueing until
+ *
+ *   dispatch: the main loop handled it
+ *   block:    the first synthesized block playing it started
+ *   output:   that block is heard, the block time plus the
+ *             audio buffered ahead of it by the stream
+ *
+ * The distributions are logged after count events, then an
+ * EVENT_QUIT is queued. Returns -1 if the thread could not be
+ * started */
+int start_latency_test(struct synthesizer *syn, size_t count);
+
+/* Call from the main loop for every handled event */
+void latency_event_handled(const struct event *ev);
+
+#endif
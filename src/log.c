@@ -1,5 +1,6 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
 #include "log.h"
@@ -18,6 +19,38 @@ static const char *s_reset = "\x1b[0m";
 
 static pthread_mutex_t s_lock;
 
+/* Messages of the audio threads, printed later by the
+ * main loop. Multiple producers, single consumer */
+#define LOG_ASYNC_SIZE    64
+#define LOG_ASYNC_LENGTH  256
+
+/* A message is free for the producer claiming position p
+ * when its sequence is p, and ready to print when it is p + 1.
+ * The sequence is stored less the index of the message, so
+ * the zero initialized ring is valid before log_init */
+struct log_message {
+  atomic_size_t sequence;
+  int           warn;
+  char          text[LOG_ASYNC_LENGTH];
+};
+
+static struct log_message s_async[LOG_ASYNC_SIZE];
+static size_t s_async_head;          /* Next message printed */
+static atomic_size_t s_async_tail;   /* Next message claimed */
+static atomic_ulong s_async_dropped;
+
+static size_t load_sequence(size_t pos)
+{
+  size_t index = pos % LOG_ASYNC_SIZE;
+  return atomic_load_explicit(&s_async[index].sequence, memory_order_acquire) + index;
+}
+
+static void store_sequence(size_t pos, size_t sequence)
+{
+  size_t index = pos % LOG_ASYNC_SIZE;
+  atomic_store_explicit(&s_async[index].sequence, sequence - index, memory_order_release);
+}
+
 void log_init(void)
 {
   pthread_mutexattr_t attr;
@@ -84,3 +117,73 @@ void log_info_hl(const char *fmt, ...)
 
   pthread_mutex_unlock(&s_lock);
 }
+
+static void log_async(int warn, const char *fmt, va_list ap)
+{
+  size_t pos = atomic_load_explicit(&s_async_tail, memory_order_relaxed);
+  struct log_message *msg;
+
+  for (;;) {
+    msg = &s_async[pos % LOG_ASYNC_SIZE];
+    size_t sequence = load_sequence(pos);
+
+    if (sequence == pos) {
+      if (atomic_compare_exchange_weak_explicit(&s_async_tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < pos) {
+      /* Not printed yet */
+      atomic_fetch_add_explicit(&s_async_dropped, 1, memory_order_relaxed);
+      return;
+    } else {
+      pos = atomic_load_explicit(&s_async_tail, memory_order_relaxed);
+    }
+  }
+
+  msg->warn = warn;
+  vsnprintf(msg->text, sizeof(msg->text), fmt, ap);
+
+  store_sequence(pos, pos + 1);
+}
+
+void log_info_async(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  log_async(0, fmt, ap);
+  va_end(ap);
+}
+
+void log_warn_async(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  log_async(1, fmt, ap);
+  va_end(ap);
+}
+
+void log_flush_async(void)
+{
+  for (;;) {
+    struct log_message *msg = &s_async[s_async_head % LOG_ASYNC_SIZE];
+
+    if (load_sequence(s_async_head) != s_async_head + 1) {
+      break;
+    }
+
+    if (msg->warn) {
+      log_warn("%s", msg->text);
+    } else {
+      log_info("%s", msg->text);
+    }
+
+    store_sequence(s_async_head, s_async_head + LOG_ASYNC_SIZE);
+    s_async_head++;
+  }
+
+  unsigned long dropped = atomic_exchange_explicit(&s_async_dropped, 0, memory_order_relaxed);
+  if (dropped) {
+    log_warn("%lu messages of the audio thread dropped", dropped);
+  }
+}
@@ -7,4 +7,11 @@ void log_info(const char *fmt, ...);
 void log_warn(const char *fmt, ...);
 void log_info_hl(const char *fmt, ...);
 
+/* Queue a message without blocking or allocating, for the
+ * audio threads. The messages are printed by log_flush_async,
+ * called by one thread only */
+void log_info_async(const char *fmt, ...);
+void log_warn_async(const char *fmt, ...);
+void log_flush_async(void);
+
 #endif
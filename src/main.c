@@ -1,5 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "audio-file.h"
 #include "xmalloc.h"
@@ -11,6 +16,10 @@
 #include "log.h"
 #include "synthesizer.h"
 #include "midi.h"
+#include "render.h"
+#include "batch.h"
+#include "latency.h"
+#include "mix.h"
 
 /* Set the profile automatically
  * by matching volume with 'level' field */
@@ -28,9 +37,7 @@ static void switch_profile(struct synthesizer *syn, struct config *cfg)
     log_info("Switching to profile %zu", s_current_profile_index);
   }
 
-  lock_synthesizer(syn);
   set_synthesizer_profile(syn, &cfg->profiles[s_current_profile_index], 0);
-  unlock_synthesizer(syn);
 }
 
 static void help(void)
@@ -47,19 +54,41 @@ static void help(void)
   log_info("    u       Increase fade out/profile interpolation time");
   log_info("    d       Decrease fade out/profile interpolation time");
   log_info("    r       Reload config");
+  log_info("    c       Print grain cache statistics");
+  log_info("    g       Print governor state");
   log_info("    0-9     Select profile by index");
 }
 
 int main(int argc, char **argv)
 {
-  (void) argc;
-  (void) argv;
+  log_init();
 
   int quit;
   const char *err;
   const char *audio_path = NULL;
   const char *config_path = NULL;
   const char *output_path = NULL;
+  const char *seed_arg = NULL;
+  const char *control_period_arg = NULL;
+  const char *threads_arg = NULL;
+  const char *cache_arg = NULL;
+  const char *render_ahead_arg = NULL;
+  const char *cpu_arg = NULL;
+  const char *latency_arg = NULL;
+  const char *minreq_arg = NULL;
+  const char *backend_arg = NULL;
+  const char *render_arg = NULL;
+  const char *schedule_arg = NULL;
+  const char *pitches_arg = NULL;
+  const char *batch_dir = NULL;
+  const char *latency_test_arg = NULL;
+  int governor = 0;
+  int overwrite = 0;
+  int first_sink = 0;
+
+  /* Audio files given without -f, only for batch rendering */
+  const char **paths = xcalloc(argc, sizeof(*paths));
+  size_t num_paths = 0;
 
   /* Parse command line arguments */
   for (argv++; *argv; ++argv) {
@@ -79,6 +108,15 @@ int main(int argc, char **argv)
       case 'a':
         s_auto_profile = 1;
         continue;
+      case 'g':
+        governor = 1;
+        continue;
+      case 'y':
+        overwrite = 1;
+        continue;
+      case 'D':
+        first_sink = 1;
+        continue;
       default:
         break;
       }
@@ -98,6 +136,48 @@ int main(int argc, char **argv)
       case 'o':
         output_path = arg;
         break;
+      case 's':
+        seed_arg = arg;
+        break;
+      case 'k':
+        control_period_arg = arg;
+        break;
+      case 't':
+        threads_arg = arg;
+        break;
+      case 'm':
+        cache_arg = arg;
+        break;
+      case 'b':
+        render_ahead_arg = arg;
+        break;
+      case 'p':
+        cpu_arg = arg;
+        break;
+      case 'l':
+        latency_arg = arg;
+        break;
+      case 'n':
+        minreq_arg = arg;
+        break;
+      case 'd':
+        backend_arg = arg;
+        break;
+      case 'R':
+        render_arg = arg;
+        break;
+      case 'S':
+        schedule_arg = arg;
+        break;
+      case 'P':
+        pitches_arg = arg;
+        break;
+      case 'B':
+        batch_dir = arg;
+        break;
+      case 'T':
+        latency_test_arg = arg;
+        break;
       default:
         log_err("Unknown option '-%c'", c);
         return -1;
@@ -106,11 +186,19 @@ int main(int argc, char **argv)
       continue;
     }
 
-    log_err("Invalid argument '%s'", arg);
+    paths[num_paths++] = arg;
+  }
+
+  if (batch_dir == NULL && num_paths) {
+    log_err("Invalid argument '%s'", paths[0]);
     return -1;
   }
 
-  if (audio_path == NULL) {
+  if (batch_dir && audio_path) {
+    paths[num_paths++] = audio_path;
+  }
+
+  if (audio_path == NULL && num_paths == 0) {
     log_err("Missing audio file (specify with -f <file>)");
   }
 
@@ -118,7 +206,153 @@ int main(int argc, char **argv)
     log_err("Missing config file (specify with -c <file>)");
   }
 
-  if (audio_path == NULL || config_path == NULL) {
+  if ((audio_path == NULL && num_paths == 0) || config_path == NULL) {
+    return -1;
+  }
+
+  /* Seed for grain generation, pick one from the clock
+   * if not given so the run can still be reproduced */
+  uint64_t seed = (uint64_t) time(NULL);
+  if (seed_arg) {
+    char *end;
+    seed = strtoull(seed_arg, &end, 0);
+    if (*seed_arg == 0 || *end != 0) {
+      log_err("Invalid seed '%s'", seed_arg);
+      return -1;
+    }
+  }
+
+  /* Samples between profile updates while interpolating */
+  unsigned long control_period = 0;
+  if (control_period_arg) {
+    char *end;
+    control_period = strtoul(control_period_arg, &end, 0);
+    if (*control_period_arg == 0 || *end != 0 || control_period == 0 || control_period > UINT_MAX) {
+      log_err("Invalid control period '%s'", control_period_arg);
+      return -1;
+    }
+  }
+
+  /* Number of rendering threads */
+  unsigned long threads = 1;
+  if (threads_arg) {
+    char *end;
+    threads = strtoul(threads_arg, &end, 0);
+    if (*threads_arg == 0 || *end != 0 || threads == 0) {
+      log_err("Invalid number of threads '%s'", threads_arg);
+      return -1;
+    }
+  }
+
+  /* Grain cache size in megabytes, disabled by default */
+  unsigned long cache_size = 0;
+  if (cache_arg) {
+    char *end;
+    cache_size = strtoul(cache_arg, &end, 0);
+    if (*cache_arg == 0 || *end != 0 || cache_size > SIZE_MAX >> 20) {
+      log_err("Invalid grain cache size '%s'", cache_arg);
+      return -1;
+    }
+  }
+
+  /* Stream buffers rendered ahead on a thread of
+   * its own, rendering in the write callback if 0 */
+  unsigned long render_ahead = 0;
+  if (render_ahead_arg) {
+    char *end;
+    render_ahead = strtoul(render_ahead_arg, &end, 0);
+    if (*render_ahead_arg == 0 || *end != 0 || render_ahead > 64) {
+      log_err("Invalid number of blocks to render ahead '%s'", render_ahead_arg);
+      return -1;
+    }
+  }
+
+  /* CPU the render thread is pinned to */
+  long cpu = -1;
+  if (cpu_arg) {
+    char *end;
+    cpu = strtol(cpu_arg, &end, 0);
+    if (*cpu_arg == 0 || *end != 0 || cpu < 0 || cpu > INT_MAX) {
+      log_err("Invalid CPU '%s'", cpu_arg);
+      return -1;
+    }
+    if (render_ahead == 0) {
+      log_warn("Ignoring -p, only the render thread (-b) is pinned");
+    }
+  }
+
+  /* Target latency and minimum request of the stream in
+   * milliseconds, 10-20 ms for live playing */
+  unsigned long latency = 0;
+  if (latency_arg) {
+    char *end;
+    latency = strtoul(latency_arg, &end, 0);
+    if (*latency_arg == 0 || *end != 0 || latency == 0 || latency > 10000) {
+      log_err("Invalid latency '%s'", latency_arg);
+      return -1;
+    }
+  }
+
+  unsigned long minreq = 0;
+  if (minreq_arg) {
+    char *end;
+    minreq = strtoul(minreq_arg, &end, 0);
+    if (*minreq_arg == 0 || *end != 0 || minreq == 0 || minreq > 10000) {
+      log_err("Invalid minimum request '%s'", minreq_arg);
+      return -1;
+    }
+  }
+
+  /* Seconds to render offline, playing live if 0 */
+  double render_seconds = 0.;
+  if (render_arg) {
+    char *end;
+    render_seconds = strtod(render_arg, &end);
+    if (*render_arg == 0 || *end != 0 || !(render_seconds > 0.)) {
+      log_err("Invalid render length '%s'", render_arg);
+      return -1;
+    }
+    if (batch_dir && (output_path || schedule_arg)) {
+      log_err("Options -o and -S don't apply to batch rendering (-B <directory>)");
+      return -1;
+    }
+    if (batch_dir == NULL && output_path == NULL) {
+      log_err("Missing output file for rendering (specify with -o <file>)");
+      return -1;
+    }
+
+    struct stat st;
+    if (batch_dir == NULL && !overwrite && stat(output_path, &st) == 0) {
+      log_err("Output file %s already exists (overwrite with -y)", output_path);
+      return -1;
+    }
+  } else if (batch_dir) {
+    log_err("Missing length of the renders (specify with -R <seconds>)");
+    return -1;
+  } else if (schedule_arg || pitches_arg) {
+    log_err("Options -S and -P only apply to rendering (-R <seconds>)");
+    return -1;
+  }
+
+  /* Events injected to measure control latency, none if 0 */
+  unsigned long latency_events = 0;
+  if (latency_test_arg) {
+    char *end;
+    latency_events = strtoul(latency_test_arg, &end, 0);
+    if (*latency_test_arg == 0 || *end != 0 || latency_events == 0) {
+      log_err("Invalid number of events '%s'", latency_test_arg);
+      return -1;
+    }
+    if (render_seconds > 0.) {
+      log_err("Option -T doesn't apply to rendering (-R <seconds>)");
+      return -1;
+    }
+  }
+
+  /* Pitch classes held while rendering, all by default */
+  unsigned int pitches = 0xfff;
+  if (pitches_arg && parse_pitch_classes(pitches_arg, &pitches) < 0) {
+    log_err("Invalid pitch classes '%s'", pitches_arg);
     return -1;
   }
 
@@ -131,6 +365,36 @@ int main(int argc, char **argv)
   }
   log_info("Configuration: %s", config_path);
 
+  struct schedule schedule = {0};
+  if (schedule_arg) {
+    err = parse_schedule(schedule_arg, &cfg, &schedule);
+    if (err != NULL) {
+      log_err("Invalid schedule: %s", err);
+      return -1;
+    }
+  }
+
+  log_info("Mixing kernels: %s", mix_select()->name);
+
+  /* Render every profile against every audio file, on
+   * one thread per CPU unless -t is given */
+  if (batch_dir) {
+    struct batch_settings settings = {
+      .outdir = batch_dir,
+      .seconds = render_seconds,
+      .pitches = pitches,
+      .seed = seed,
+      .threads = threads_arg ? threads : 0,
+      .overwrite = overwrite,
+    };
+
+    int failed = render_batch(&cfg, paths, num_paths, &settings);
+    free(paths);
+    free_config(&cfg);
+    return failed == 0 ? 0 : -1;
+  }
+  free(paths);
+
   /* Load audio file */
   struct audio_file *af = xcalloc(1, sizeof(*af));
   err = load_audio_file(audio_path, af);
@@ -143,6 +407,57 @@ int main(int argc, char **argv)
   log_info("Channels:      %d", af->channels);
   log_info("Sample rate:   %d", af->samplerate);
 
+  struct synthesizer *syn = create_synthesizer(af);
+  synthesizer_set_seed(syn, seed);
+  log_info("Seed:          %llu", (unsigned long long) seed);
+  set_synthesizer_profile(syn, &cfg.profiles[s_current_profile_index], 1);
+
+  /* Slots of every profile are allocated up front, the
+   * audio thread never allocates */
+  size_t max_slots = 0;
+  for (size_t i = 0; i < cfg.size; ++i) {
+    if (cfg.profiles[i].num_slots > max_slots) {
+      max_slots = cfg.profiles[i].num_slots;
+    }
+  }
+  synthesizer_reserve(syn, 0, max_slots);
+
+  sythesizer_set_interp_time(syn, s_profile_interp_time);
+  if (control_period) {
+    synthesizer_set_control_period(syn, (unsigned int) control_period);
+  }
+  if (synthesizer_set_threads(syn, threads) < 0) {
+    log_err("Failed to start %lu rendering threads", threads);
+    return -1;
+  }
+  log_info("Threads:       %lu", threads);
+  if (cache_size) {
+    if (synthesizer_set_cache_size(syn, (size_t) cache_size << 20) < 0) {
+      log_err("Failed to start the grain cache thread");
+      return -1;
+    }
+    log_info("Grain cache:   %lu MB", cache_size);
+  }
+  if (governor && render_seconds > 0.) {
+    log_warn("Ignoring -g, the governor only keeps up with real time");
+  } else if (governor) {
+    synthesizer_enable_governor(syn, 1);
+    log_info("Governor:      enabled");
+  }
+
+  /* Offline rendering needs no sound server or terminal */
+  if (render_seconds > 0.) {
+    err = open_output_file(output_path, af, 1);
+    if (err != NULL) {
+      log_err("%s", err);
+      return -1;
+    }
+
+    render_offline(syn, &cfg, &schedule, pitches, af->samplerate, af->channels, render_seconds);
+    free_schedule(&schedule);
+    return 0;
+  }
+
   err = event_loop_start(config_path);
   if (err != NULL) {
     log_err("Failed to start event loop: %s", err);
@@ -150,7 +465,7 @@ int main(int argc, char **argv)
   }
 
   if (output_path) {
-    err = open_output_file(output_path, af);
+    err = open_output_file(output_path, af, overwrite);
     if (err != NULL) {
       log_err("%s", err);
       return -1;
@@ -159,6 +474,12 @@ int main(int argc, char **argv)
 
   midi_init();
 
+  if (backend_arg && select_audio_backend(backend_arg) < 0) {
+    log_err("Unknown audio backend '%s' (pulse, alsa or null)", backend_arg);
+    return -1;
+  }
+  log_info("Audio backend: %s", get_audio_backend_name());
+
   if (init_audio() < 0) {
     err = get_audio_error_string();
     log_err("Failed to initalize audio: %s", err);
@@ -169,16 +490,25 @@ int main(int argc, char **argv)
    * (sample rate and number of channels) */
   match_audio_file_sample_spec(af);
 
-  /* Let the user select a sink... */
+  /* Let the user select a sink, or take the first with -D */
   struct list *l = list_sinks();
-  log_info("Select sink ('q' to quit):");
-  struct list *sink = list_select(l);
+  if (l == NULL) {
+    log_err("No sinks found");
+    return -1;
+  }
+
+  struct list *sink = l;
+  if (!first_sink) {
+    log_info("Select sink ('q' to quit):");
+    sink = list_select(l);
+  }
 
   if (sink == NULL) {
     log_info("Quit");
     return 0;
   }
 
+  set_stream_latency((unsigned int) latency, (unsigned int) minreq);
   if (connect_sink(sink->name) < 0) {
     err = get_audio_error_string();
     log_err("%s", err);
@@ -187,9 +517,10 @@ int main(int argc, char **argv)
   log_info("Selected sink %s", sink->name);
   free_list(l);
 
-  struct synthesizer *syn = create_synthesizer(af);
-  set_synthesizer_profile(syn, &cfg.profiles[s_current_profile_index], 1);
-  sythesizer_set_interp_time(syn, s_profile_interp_time);
+  if (render_ahead) {
+    set_render_ahead(render_ahead, (int) cpu);
+    log_info("Render ahead:  %lu blocks", render_ahead);
+  }
 
   if (start_stream(syn) < 0) {
     err = get_audio_error_string();
@@ -200,8 +531,16 @@ int main(int argc, char **argv)
   log_info("Ready");
   log_info("Press 'h' for a list of key bindings");
 
+  if (latency_events) {
+    if (start_latency_test(syn, latency_events) < 0) {
+      log_err("Failed to start latency test");
+      return -1;
+    }
+    log_info("Measuring control latency over %lu events", latency_events);
+  }
+
   /* Print current config */
-  struct event pevent;
+  struct event pevent = {0};
   pevent.type = EVENT_INPUT;
   pevent.c = 'p';
   queue_event(&pevent);
@@ -321,6 +660,35 @@ int main(int argc, char **argv)
           break;
         }
 
+        case 'c':
+        {
+          struct grain_cache_stats stats;
+          int enabled = synthesizer_get_cache_stats(syn, &stats) == 0;
+          if (!enabled) {
+            log_info("Grain cache is disabled (enable with -m <megabytes>)");
+            break;
+          }
+          log_info("Grain cache: %lu hits, %lu misses, %lu evictions, %lu not rendered",
+                   stats.hits, stats.misses, stats.evictions, stats.dropped);
+          log_info("Grain cache: %zu entries, %.1f MB",
+                   stats.entries, (double) stats.bytes / (1 << 20));
+          break;
+        }
+
+        case 'g':
+        {
+          struct governor gov;
+          synthesizer_get_governor(syn, &gov);
+          if (!gov.enabled) {
+            log_info("Governor is disabled (enable with -g)");
+            break;
+          }
+          log_info("Governor: load %.0f%%, slots limited to %.0f%%, interpolation up to %s",
+                   gov.load * 100.f, gov.slot_limit * 100.f,
+                   get_interpolation_name(gov.interpolation));
+          break;
+        }
+
         default:
           if ('0' <= ev.c && ev.c <= '9') {
             if (s_auto_profile) {
@@ -363,9 +731,7 @@ int main(int argc, char **argv)
             switch_profile(syn, &cfg);
           } else {
             /* No message if index didn't change */
-            lock_synthesizer(syn);
             set_synthesizer_profile(syn, &cfg.profiles[s_current_profile_index], 0);
-            unlock_synthesizer(syn);
           }
         }
 
@@ -374,21 +740,24 @@ int main(int argc, char **argv)
 
       case EVENT_MIDI:
       {
-        lock_synthesizer(syn);
+        latency_event_handled(&ev);
         if (ev.on) {
           synthesizer_note_on(syn, ev.pitch);
         } else {
           synthesizer_note_off(syn, ev.pitch);
         }
-        unlock_synthesizer(syn);
         break;
       }
 
       case EVENT_FREEZE:
       {
-        lock_synthesizer(syn);
         synthesizer_freeze_pitches(syn, ev.freeze);
-        unlock_synthesizer(syn);
+        break;
+      }
+
+      case EVENT_QUIT:
+      {
+        quit = 1;
         break;
       }
     }
@@ -36,7 +36,7 @@ static void *midi_proc(void *args)
   for (;;) {
     int num_events_read = Pm_Read(s_stream, s_event_buf, EVENT_BUF_SIZE);
     for (int i = 0; i < num_events_read; ++i) {
-      struct event ev;
+      struct event ev = {0};
       int status = Pm_MessageStatus(s_event_buf[i].message);
       int data1 = Pm_MessageData1(s_event_buf[i].message);
       int data2 = Pm_MessageData2(s_event_buf[i].message);
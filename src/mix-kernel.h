@@ -0,0 +1,178 @@
+/* Vectorized grain mixing kernel template. This file is included
+ * by mix.c once per instruction set, with the following defined:
+ *
+ *   MIX_NAME                Name of the instruction set, the kernels
+ *                           are defined as struct mix_kernels mix_<name>
+ *   MIX_WIDTH               Number of lanes
+ *   MIX_VF, MIX_VI, MIX_VU  Float, int32 and uint32 vector types of MIX_WIDTH lanes
+ *   MIX_GATHER(data, idx)   Load data[idx[i]] in to each lane
+ *
+ * Each lane processes one consecutive sample of the run, the
+ * remainder is handled by run_sample. See mix_scalar for the
+ * reference. Every variant is a separate function, with the
+ * kernel argument of MIX_FN(run) folded at compile time */
+
+#define MIX_FN(name) MIX_CAT(MIX_CAT(mix, MIX_NAME), name)
+
+/* Interpolate the source at pos + frac / 2^32 in each lane */
+static inline __attribute__((always_inline))
+MIX_VF MIX_FN(interpolate)(const float *data, MIX_VI pos, MIX_VU frac,
+                           enum interpolation interpolation)
+{
+  MIX_VF t = __builtin_convertvector((MIX_VI) (frac >> 8), MIX_VF) * MIX_FIXED_SCALE;
+
+  switch (interpolation) {
+  case INTERPOLATION_CUBIC:
+  {
+    MIX_VF xm1 = MIX_GATHER(data, pos - 1);
+    MIX_VF x0 = MIX_GATHER(data, pos);
+    MIX_VF x1 = MIX_GATHER(data, pos + 1);
+    MIX_VF x2 = MIX_GATHER(data, pos + 2);
+    MIX_VF c1 = .5f * (x1 - xm1);
+    MIX_VF c2 = xm1 - 2.5f * x0 + 2.f * x1 - .5f * x2;
+    MIX_VF c3 = .5f * (x2 - xm1) + 1.5f * (x0 - x1);
+    return ((c3 * t + c2) * t + c1) * t + x0;
+  }
+
+  case INTERPOLATION_SINC:
+  {
+    /* Row offset in the coefficient table, frac is rounded to the
+     * nearest phase. The carry out of the rounding selects the
+     * last row */
+    const float *table = get_sinc_table();
+    MIX_VU rounded = frac + SINC_ROUND;
+    MIX_VI row = (MIX_VI) (rounded >> (32 - SINC_BITS)) + ((rounded < frac) & SINC_PHASES);
+    row *= SINC_TAPS;
+    pos -= INTERPOLATION_LEFT;
+
+    MIX_VF acc = {0};
+    for (int tap = 0; tap < SINC_TAPS; ++tap) {
+      acc += MIX_GATHER(data, pos + tap) * MIX_GATHER(table, row + tap);
+    }
+    return acc;
+  }
+
+  default:
+  {
+    MIX_VF x0 = MIX_GATHER(data, pos);
+    MIX_VF x1 = MIX_GATHER(data, pos + 1);
+    return x0 + (x1 - x0) * t;
+  }
+  }
+}
+
+static inline __attribute__((always_inline))
+void MIX_FN(run)(float *out, size_t n, const struct grain_run *r, int kernel)
+{
+  MIX_VI lane, lane_int, reverse;
+  MIX_VU lane_frac;
+  const int narrow = (uint64_t) r->phase_step * (MIX_WIDTH - 1) < (1u << (32 - WINDOW_BITS));
+  const float *src = r->data + (r->position >> 32);
+  size_t i;
+
+  /* Position offset of each lane from the first lane,
+   * split in integer and fractional part */
+  for (int l = 0; l < MIX_WIDTH; ++l) {
+    int64_t offset = (int64_t) l * r->step;
+    lane[l] = l;
+    lane_int[l] = (int32_t) (offset >> 32);
+    lane_frac[l] = (uint32_t) offset;
+    reverse[l] = MIX_WIDTH - 1 - l;
+  }
+
+  for (i = 0; i + MIX_WIDTH <= n; i += MIX_WIDTH) {
+    MIX_VI index = lane + (int32_t) i;
+
+    /* Reads stay within the guard regions, so no wrapping */
+    MIX_VF af_sample;
+    if (kernel == MIX_COPY) {
+      /* Consecutive source samples, a plain load */
+      __builtin_memcpy(&af_sample, src + i, sizeof(af_sample));
+    } else if (kernel == MIX_COPY_REVERSE) {
+      /* Consecutive source samples backwards, load and
+       * reverse the lanes */
+      __builtin_memcpy(&af_sample, src - i - (MIX_WIDTH - 1), sizeof(af_sample));
+      af_sample = __builtin_shuffle(af_sample, reverse);
+    } else {
+      /* Fixed point position of each lane, the fractional
+       * part carries in to the integer part on overflow */
+      int64_t position = r->position + (int64_t) i * r->step;
+      MIX_VU frac = (uint32_t) position + lane_frac;
+      MIX_VI pos = (int32_t) (position >> 32) + lane_int - (frac < lane_frac);
+      af_sample = MIX_FN(interpolate)(r->data, pos, frac, kernel);
+    }
+
+    /* Look up envelope, interpolating between table entries */
+    MIX_VU phase = r->phase + r->phase_step * (MIX_VU) index;
+    MIX_VI windex = (MIX_VI) (phase >> (32 - WINDOW_BITS));
+    MIX_VF wfrac = __builtin_convertvector((MIX_VI) (phase & WINDOW_PHASE_MASK), MIX_VF) * WINDOW_PHASE_SCALE;
+    MIX_VF wleft, wright;
+    if (narrow) {
+      /* All lanes are within two table entries, broadcast
+       * them instead of gathering */
+      const float *w = &r->window[windex[0]];
+      MIX_VI first = windex == windex[0];
+      wleft = MIX_SELECT(first, (MIX_VF) {0} + w[0], (MIX_VF) {0} + w[1]);
+      wright = MIX_SELECT(first, (MIX_VF) {0} + w[1], (MIX_VF) {0} + w[2]);
+    } else {
+      wleft = MIX_GATHER(r->window, windex);
+      wright = MIX_GATHER(r->window, windex + 1);
+    }
+    MIX_VF env = wleft + (wright - wleft) * wfrac;
+
+    MIX_VF gain = r->gain + r->gain_step * __builtin_convertvector(index, MIX_VF);
+
+    MIX_VF acc;
+    __builtin_memcpy(&acc, &out[i], sizeof(acc));
+    acc += af_sample * env * gain;
+    __builtin_memcpy(&out[i], &acc, sizeof(acc));
+  }
+
+  for (; i < n; ++i) {
+    out[i] += run_sample(r, i, kernel);
+  }
+}
+
+static void MIX_FN(linear)(float *out, size_t n, const struct grain_run *r)
+{
+  MIX_FN(run)(out, n, r, INTERPOLATION_LINEAR);
+}
+
+static void MIX_FN(cubic)(float *out, size_t n, const struct grain_run *r)
+{
+  MIX_FN(run)(out, n, r, INTERPOLATION_CUBIC);
+}
+
+static void MIX_FN(sinc)(float *out, size_t n, const struct grain_run *r)
+{
+  MIX_FN(run)(out, n, r, INTERPOLATION_SINC);
+}
+
+static void MIX_FN(copy)(float *out, size_t n, const struct grain_run *r)
+{
+  MIX_FN(run)(out, n, r, MIX_COPY);
+}
+
+static void MIX_FN(copy_reverse)(float *out, size_t n, const struct grain_run *r)
+{
+  MIX_FN(run)(out, n, r, MIX_COPY_REVERSE);
+}
+
+static const struct mix_kernels MIX_CAT(mix, MIX_NAME) = {
+  .name = MIX_STR(MIX_NAME),
+  .run = {
+    [INTERPOLATION_LINEAR] = MIX_FN(linear),
+    [INTERPOLATION_CUBIC]  = MIX_FN(cubic),
+    [INTERPOLATION_SINC]   = MIX_FN(sinc),
+    [MIX_COPY]             = MIX_FN(copy),
+    [MIX_COPY_REVERSE]     = MIX_FN(copy_reverse),
+  },
+};
+
+#undef MIX_FN
+#undef MIX_NAME
+#undef MIX_WIDTH
+#undef MIX_VF
+#undef MIX_VI
+#undef MIX_VU
+#undef MIX_GATHER
@@ -0,0 +1,310 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "xmalloc.h"
+#include "window.h"
+#include "mix.h"
+
+/* Reallocate one grain array, keeping old entries and
+ * zeroing new ones */
+static void *grow_array(void *old, size_t old_capac, size_t capac, size_t elsize)
+{
+  void *ptr = xaligned_alloc(MIX_ALIGN, capac * elsize);
+
+  if (old) {
+    memcpy(ptr, old, old_capac * elsize);
+  }
+  memset((char *) ptr + old_capac * elsize, 0, (capac - old_capac) * elsize);
+  free(old);
+
+  return ptr;
+}
+
+void grains_reserve(struct grains *g, size_t n)
+{
+  size_t capac;
+
+  if (n <= g->capac) {
+    return;
+  }
+
+  capac = (n + MIX_LANES - 1) / MIX_LANES * MIX_LANES;
+
+  g->offset     = grow_array(g->offset, g->capac, capac, sizeof(*g->offset));
+  g->length     = grow_array(g->length, g->capac, capac, sizeof(*g->length));
+  g->cooldown   = grow_array(g->cooldown, g->capac, capac, sizeof(*g->cooldown));
+  g->cursor     = grow_array(g->cursor, g->capac, capac, sizeof(*g->cursor));
+  g->gain       = grow_array(g->gain, g->capac, capac, sizeof(*g->gain));
+  g->step       = grow_array(g->step, g->capac, capac, sizeof(*g->step));
+  g->level      = grow_array(g->level, g->capac, capac, sizeof(*g->level));
+  g->reverse    = grow_array(g->reverse, g->capac, capac, sizeof(*g->reverse));
+  g->kernel     = grow_array(g->kernel, g->capac, capac, sizeof(*g->kernel));
+  g->window     = grow_array(g->window, g->capac, capac, sizeof(*g->window));
+  g->phase_step = grow_array(g->phase_step, g->capac, capac, sizeof(*g->phase_step));
+  g->cached     = grow_array(g->cached, g->capac, capac, sizeof(*g->cached));
+  g->capac = capac;
+}
+
+void grains_swap(struct grains *g, struct grains *larger)
+{
+  struct grains old = *g;
+  size_t n = g->capac;
+
+  memcpy(larger->offset, g->offset, n * sizeof(*g->offset));
+  memcpy(larger->length, g->length, n * sizeof(*g->length));
+  memcpy(larger->cooldown, g->cooldown, n * sizeof(*g->cooldown));
+  memcpy(larger->cursor, g->cursor, n * sizeof(*g->cursor));
+  memcpy(larger->gain, g->gain, n * sizeof(*g->gain));
+  memcpy(larger->step, g->step, n * sizeof(*g->step));
+  memcpy(larger->level, g->level, n * sizeof(*g->level));
+  memcpy(larger->reverse, g->reverse, n * sizeof(*g->reverse));
+  memcpy(larger->kernel, g->kernel, n * sizeof(*g->kernel));
+  memcpy(larger->window, g->window, n * sizeof(*g->window));
+  memcpy(larger->phase_step, g->phase_step, n * sizeof(*g->phase_step));
+  memcpy(larger->cached, g->cached, n * sizeof(*g->cached));
+
+  *g = *larger;
+  *larger = old;
+}
+
+void grains_free(struct grains *g)
+{
+  free(g->offset);
+  free(g->length);
+  free(g->cooldown);
+  free(g->cursor);
+  free(g->gain);
+  free(g->step);
+  free(g->level);
+  free(g->reverse);
+  free(g->kernel);
+  free(g->window);
+  free(g->phase_step);
+  free(g->cached);
+  memset(g, 0, sizeof(*g));
+}
+
+void mix_add(float *out, const float *in, size_t n, float gain, float gain_step)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] += in[i] * (gain + gain_step * (float) i);
+  }
+}
+
+/* Fractional part of the envelope phase between table entries */
+#define WINDOW_PHASE_MASK  ((1u << (32 - WINDOW_BITS)) - 1)
+#define WINDOW_PHASE_SCALE (1.f / (float) (1u << (32 - WINDOW_BITS)))
+
+/* Row of the sinc table for a fractional position */
+#define SINC_ROUND (1u << (32 - SINC_BITS - 1))
+
+/* Interpolate the source at pos + frac / 2^32 */
+static inline float interpolate(const float *data, int pos, uint32_t frac,
+                                enum interpolation interpolation)
+{
+  float t = (float) (frac >> 8) * MIX_FIXED_SCALE;
+
+  switch (interpolation) {
+  case INTERPOLATION_CUBIC:
+  {
+    float xm1 = data[pos - 1];
+    float x0 = data[pos];
+    float x1 = data[pos + 1];
+    float x2 = data[pos + 2];
+    float c1 = .5f * (x1 - xm1);
+    float c2 = xm1 - 2.5f * x0 + 2.f * x1 - .5f * x2;
+    float c3 = .5f * (x2 - xm1) + 1.5f * (x0 - x1);
+    return ((c3 * t + c2) * t + c1) * t + x0;
+  }
+
+  case INTERPOLATION_SINC:
+  {
+    const float *row = get_sinc_table() + ((uint64_t) frac + SINC_ROUND) / (1ull << (32 - SINC_BITS)) * SINC_TAPS;
+    const float *src = data + pos - INTERPOLATION_LEFT;
+    float acc = 0.f;
+    for (int tap = 0; tap < SINC_TAPS; ++tap) {
+      acc += src[tap] * row[tap];
+    }
+    return acc;
+  }
+
+  default:
+    return data[pos] + (data[pos + 1] - data[pos]) * t;
+  }
+}
+
+/* Compute sample i of a grain run, kernel is an interpolation
+ * or enum mix_kernel */
+static inline float run_sample(const struct grain_run *r, size_t i, int kernel)
+{
+  /* Split fixed point position in integer and fractional part */
+  int64_t position = r->position + (int64_t) i * r->step;
+  float af_sample;
+  if (kernel == MIX_COPY || kernel == MIX_COPY_REVERSE) {
+    af_sample = r->data[position >> 32];
+  } else {
+    af_sample = interpolate(r->data, (int) (position >> 32), (uint32_t) position, kernel);
+  }
+
+  /* Look up envelope, interpolating between table entries */
+  unsigned int phase = r->phase + r->phase_step * i;
+  unsigned int windex = phase >> (32 - WINDOW_BITS);
+  float wfrac = (float) (phase & WINDOW_PHASE_MASK) * WINDOW_PHASE_SCALE;
+  float env = r->window[windex] + (r->window[windex + 1] - r->window[windex]) * wfrac;
+
+  return af_sample * env * (r->gain + r->gain_step * (float) i);
+}
+
+static void mix_scalar_run(float *out, size_t n, const struct grain_run *r, int kernel)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] += run_sample(r, i, kernel);
+  }
+}
+
+static void mix_scalar_linear(float *out, size_t n, const struct grain_run *r)
+{
+  mix_scalar_run(out, n, r, INTERPOLATION_LINEAR);
+}
+
+static void mix_scalar_cubic(float *out, size_t n, const struct grain_run *r)
+{
+  mix_scalar_run(out, n, r, INTERPOLATION_CUBIC);
+}
+
+static void mix_scalar_sinc(float *out, size_t n, const struct grain_run *r)
+{
+  mix_scalar_run(out, n, r, INTERPOLATION_SINC);
+}
+
+static void mix_scalar_copy(float *out, size_t n, const struct grain_run *r)
+{
+  mix_scalar_run(out, n, r, MIX_COPY);
+}
+
+static void mix_scalar_copy_reverse(float *out, size_t n, const struct grain_run *r)
+{
+  mix_scalar_run(out, n, r, MIX_COPY_REVERSE);
+}
+
+const struct mix_kernels mix_scalar = {
+  .name = "scalar",
+  .run = {
+    [INTERPOLATION_LINEAR] = mix_scalar_linear,
+    [INTERPOLATION_CUBIC]  = mix_scalar_cubic,
+    [INTERPOLATION_SINC]   = mix_scalar_sinc,
+    [MIX_COPY]             = mix_scalar_copy,
+    [MIX_COPY_REVERSE]     = mix_scalar_copy_reverse,
+  },
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define MIX_CAT_(a, b) a##_##b
+#define MIX_CAT(a, b) MIX_CAT_(a, b)
+#define MIX_STR_(a) #a
+#define MIX_STR(a) MIX_STR_(a)
+
+/* Lane-wise select on GCC vector types, m is a comparison result */
+#define MIX_SELECT(m, a, b) ((MIX_VF) (((MIX_VI) (a) & (m)) | ((MIX_VI) (b) & ~(m))))
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+typedef float   vf4 __attribute__((vector_size(16)));
+typedef int32_t vi4 __attribute__((vector_size(16)));
+typedef uint32_t vu4 __attribute__((vector_size(16)));
+#define MIX_NAME   sse2
+#define MIX_WIDTH  4
+#define MIX_VF     vf4
+#define MIX_VI     vi4
+#define MIX_VU     vu4
+#define MIX_GATHER(data, idx) ((vf4) { (data)[(idx)[0]], (data)[(idx)[1]], (data)[(idx)[2]], (data)[(idx)[3]] })
+#include "mix-kernel.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+typedef float   vf8 __attribute__((vector_size(32)));
+typedef int32_t vi8 __attribute__((vector_size(32)));
+typedef uint32_t vu8 __attribute__((vector_size(32)));
+#define MIX_NAME   avx2
+#define MIX_WIDTH  8
+#define MIX_VF     vf8
+#define MIX_VI     vi8
+#define MIX_VU     vu8
+#define MIX_GATHER(data, idx) ((vf8) _mm256_i32gather_ps((data), (__m256i) (idx), 4))
+#include "mix-kernel.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+typedef float   vf16 __attribute__((vector_size(64)));
+typedef int32_t vi16 __attribute__((vector_size(64)));
+typedef uint32_t vu16 __attribute__((vector_size(64)));
+#define MIX_NAME   avx512
+#define MIX_WIDTH  16
+#define MIX_VF     vf16
+#define MIX_VI     vi16
+#define MIX_VU     vu16
+#define MIX_GATHER(data, idx) ((vf16) _mm512_i32gather_ps((__m512i) (idx), (data), 4))
+#include "mix-kernel.h"
+#pragma GCC pop_options
+
+#endif
+
+/* Widest kernels supported by the CPU */
+static const struct mix_kernels *select_widest(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f")) {
+    return &mix_avx512;
+  }
+
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return &mix_avx2;
+  }
+
+  if (__builtin_cpu_supports("sse2")) {
+    return &mix_sse2;
+  }
+#endif
+
+  return &mix_scalar;
+}
+
+/* Kernel sets from widest to narrowest */
+static const struct mix_kernels *const s_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+  &mix_avx512,
+  &mix_avx2,
+  &mix_sse2,
+#endif
+  &mix_scalar,
+};
+
+const struct mix_kernels *mix_select(void)
+{
+  const struct mix_kernels *widest = select_widest();
+  const char *name = getenv("MIX_KERNELS");
+  int supported = 0;
+
+  if (name == NULL) {
+    return widest;
+  }
+
+  /* Any set narrower than the widest supported one runs too */
+  for (size_t i = 0; i < sizeof(s_kernels) / sizeof(*s_kernels); ++i) {
+    supported |= s_kernels[i] == widest;
+    if (supported && strcmp(s_kernels[i]->name, name) == 0) {
+      return s_kernels[i];
+    }
+  }
+
+  return widest;
+}
@@ -0,0 +1,93 @@
+#ifndef MIX_H
+#define MIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "interpolation.h"
+
+struct grain_cache_entry;
+
+/* Alignment (in bytes) and padding (in grains) of the grain
+ * arrays, enough for the widest vector unit (AVX-512, 16 floats) */
+#define MIX_ALIGN 64
+#define MIX_LANES 16
+
+/* Structure-of-arrays grain storage, one entry per slot.
+ * Every array is MIX_ALIGN aligned and holds capac entries,
+ * capac being a multiple of MIX_LANES. Unused entries are zero */
+struct grains {
+  unsigned int  *offset;       /* Absolute offset within audio file */
+  unsigned int  *length;       /* Length of grain in samples */
+  unsigned int  *cooldown;     /* Samples left before the grain is played */
+  unsigned int  *cursor;       /* Samples played so far */
+  float         *gain;
+  uint64_t      *step;         /* Playback rate within the level, 32.32 fixed point */
+  int           *level;        /* Mip level of the source, see audio-file.h */
+  int           *reverse;
+  int           *kernel;       /* See enum mix_kernel */
+  const float  **window;       /* Envelope table, see window.h */
+  unsigned int  *phase_step;   /* Envelope phase increment per sample */
+  struct grain_cache_entry **cached; /* Pre-rendered grain, or NULL */
+  size_t         capac;
+};
+
+/* Fixed point helpers for 32.32 read positions */
+#define MIX_FIXED_ONE   4294967296.0
+#define MIX_FIXED_SCALE (1.f / (float) (1 << 24))
+
+/* A contiguous run of samples from one grain */
+struct grain_run {
+  const float   *data;         /* Guard padded source samples */
+  int64_t        position;     /* Read position of the first sample, 32.32 fixed point */
+  int64_t        step;         /* Added to position for every sample, negative in reverse */
+  const float   *window;       /* Envelope table */
+  unsigned int   phase;        /* Envelope phase at the first sample of the run, */
+  unsigned int   phase_step;   /* a full turn of 2^32 spans the grain */
+  float          gain;         /* Gain at the first sample of the run... */
+  float          gain_step;    /* ...incremented by this for every sample */
+};
+
+/* Mix n samples of a grain run in to out. The run must not
+ * extend past the end of the grain, and every read position
+ * must be within the guard regions of the source, including the
+ * INTERPOLATION_LEFT/RIGHT neighbours */
+typedef void (*mix_fn)(float *out, size_t n, const struct grain_run *r);
+
+/* Kernel variants. The first INTERPOLATION_COUNT resample the
+ * source with the interpolation of the same index. Grains played
+ * at the original rate, step being exactly +-1, read the source
+ * as is instead */
+enum mix_kernel {
+  MIX_COPY = INTERPOLATION_COUNT,   /* Forward at the original rate */
+  MIX_COPY_REVERSE,                 /* Reverse at the original rate */
+  MIX_KERNEL_COUNT,
+};
+
+/* A set of kernels for one instruction set, indexed
+ * by interpolation or enum mix_kernel */
+struct mix_kernels {
+  const char    *name;
+  mix_fn         run[MIX_KERNEL_COUNT];
+};
+
+/* Add a pre-rendered grain with a linear gain ramp */
+void mix_add(float *out, const float *in, size_t n, float gain, float gain_step);
+
+/* Grow grain arrays to hold at least n grains */
+void grains_reserve(struct grains *g, size_t n);
+/* Copy the grains of g in to the arrays of larger, which
+ * must hold at least as many, and swap the arrays. larger ends
+ * up with the old arrays. Doesn't allocate */
+void grains_swap(struct grains *g, struct grains *larger);
+void grains_free(struct grains *g);
+
+/* Reference implementation */
+extern const struct mix_kernels mix_scalar;
+
+/* Select the widest kernels supported by the CPU, or the
+ * narrower set named by MIX_KERNELS in the environment
+ * (avx512, avx2, sse2 or scalar) */
+const struct mix_kernels *mix_select(void);
+
+#endif
@@ -3,25 +3,109 @@
 #include <sndfile.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "output.h"
+#include "xmalloc.h"
 #include "log.h"
 
+/* Seconds of audio buffered for the writer thread */
+#define OUTPUT_BUFFER_TIME 2
+
+/* Milliseconds the writer thread sleeps between writes */
+#define OUTPUT_WRITE_INTERVAL 20
+
+/* Milliseconds a waiting write sleeps while the ring is full */
+#define OUTPUT_WAIT_INTERVAL 1
+
 static const char *s_name;
 static char s_errorbuf[512] = {0};
 static SNDFILE *s_file = NULL;
 
+/* Samples are passed to the writer thread through a single
+ * producer, single consumer ring, so the audio thread never
+ * touches the disk */
+static float *s_ring;
+static size_t s_ring_size;              /* Whole frames */
+static size_t s_channels;
+static atomic_size_t s_ring_head;       /* Next sample written to disk */
+static atomic_size_t s_ring_tail;       /* Next sample queued */
+static atomic_ulong s_dropped;          /* Samples that didn't fit in the ring */
+static atomic_int s_quit;
+static pthread_t s_writer;
+
+/* Write queued samples to disk, returns the number
+ * of samples written */
+static size_t write_queued(void)
+{
+  size_t head = atomic_load_explicit(&s_ring_head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&s_ring_tail, memory_order_acquire);
+  size_t written = tail - head;
+
+  while (head != tail) {
+    size_t offset = head % s_ring_size;
+    size_t n = tail - head;
+    if (n > s_ring_size - offset) {
+      n = s_ring_size - offset;
+    }
+
+    sf_count_t count = sf_write_float(s_file, s_ring + offset, n);
+    if (count <= 0) {
+      /* Disk error, drop the samples rather than spin */
+      count = n;
+    }
+    head += count;
+    atomic_store_explicit(&s_ring_head, head, memory_order_release);
+  }
+
+  return written;
+}
+
+static void *writer_main(void *arg)
+{
+  (void) arg;
+  struct timespec interval = {
+    .tv_sec = 0,
+    .tv_nsec = OUTPUT_WRITE_INTERVAL * 1000000L,
+  };
+
+  while (!atomic_load_explicit(&s_quit, memory_order_acquire)) {
+    size_t written = write_queued();
+
+    unsigned long dropped = atomic_exchange_explicit(&s_dropped, 0, memory_order_relaxed);
+    if (dropped) {
+      log_warn("Output file %s: writing fell behind, %lu samples dropped", s_name, dropped);
+    }
+
+    /* Keep writing while samples come in faster
+     * than real time, as when rendering offline */
+    if (written == 0) {
+      nanosleep(&interval, NULL);
+    }
+  }
+
+  write_queued();
+
+  return NULL;
+}
+
 static void cleanup(void)
 {
+  atomic_store_explicit(&s_quit, 1, memory_order_release);
+  pthread_join(s_writer, NULL);
+
   log_info("Closing output file %s", s_name);
   sf_close(s_file);
+  free(s_ring);
 }
 
-const char *open_output_file(const char *name, struct audio_file *input_file)
+const char *open_output_file(const char *name, struct audio_file *input_file, int overwrite)
 {
   struct stat st;
 
-  if (stat(name, &st) == 0) {
+  if (!overwrite && stat(name, &st) == 0) {
     log_info("Output file %s already exists. Do you want to overwrite it? (y/n)", name);
 
     char c;
@@ -57,21 +141,82 @@ const char *open_output_file(const char *name, struct audio_file *input_file)
     return s_errorbuf;
   }
 
+  s_channels = input_file->channels;
+  s_ring_size = (size_t) input_file->samplerate * s_channels * OUTPUT_BUFFER_TIME;
+  s_ring = xmalloc(sizeof(*s_ring) * s_ring_size);
+  atomic_init(&s_ring_head, 0);
+  atomic_init(&s_ring_tail, 0);
+  atomic_init(&s_dropped, 0);
+  atomic_init(&s_quit, 0);
+  s_name = name;
+
+  if (pthread_create(&s_writer, NULL, writer_main, NULL) != 0) {
+    sf_close(s_file);
+    s_file = NULL;
+    free(s_ring);
+    return "Failed to start output file writer";
+  }
+
   log_info("Output file is %s", name);
   atexit(cleanup);
-  s_name = name;
 
   return NULL;
 }
 
+/* Copy as many whole frames as fit in to the ring, returns
+ * the number of samples queued */
+static size_t queue_samples(float *data, size_t size)
+{
+  size_t tail = atomic_load_explicit(&s_ring_tail, memory_order_relaxed);
+  size_t room = s_ring_size - (tail - atomic_load_explicit(&s_ring_head, memory_order_acquire));
+
+  room -= room % s_channels;
+  if (size > room) {
+    size = room;
+  }
+
+  /* Copy in to the ring, wrapping at most once */
+  size_t offset = tail % s_ring_size;
+  size_t n = size < s_ring_size - offset ? size : s_ring_size - offset;
+  memcpy(s_ring + offset, data, sizeof(*data) * n);
+  memcpy(s_ring, data + n, sizeof(*data) * (size - n));
+
+  atomic_store_explicit(&s_ring_tail, tail + size, memory_order_release);
+
+  return size;
+}
+
 void write_to_output_file(float *data, size_t size)
 {
   if (s_file == NULL) {
     return;
   }
 
-  size_t offset = 0;
-  while (offset < size) {
-    offset += sf_write_float(s_file, data + offset, size - offset);
+  size_t n = queue_samples(data, size);
+  if (n < size) {
+    atomic_fetch_add_explicit(&s_dropped, size - n, memory_order_relaxed);
+  }
+}
+
+void write_to_output_file_wait(float *data, size_t size)
+{
+  struct timespec interval = {
+    .tv_sec = 0,
+    .tv_nsec = OUTPUT_WAIT_INTERVAL * 1000000L,
+  };
+
+  if (s_file == NULL) {
+    return;
+  }
+
+  for (;;) {
+    size_t n = queue_samples(data, size);
+    data += n;
+    size -= n;
+
+    if (size == 0) {
+      break;
+    }
+    nanosleep(&interval, NULL);
   }
 }
@@ -5,7 +5,18 @@
 
 #include "audio-file.h"
 
-const char *open_output_file(const char *name, struct audio_file *input_file);
+/* Open the output file, asking before overwriting an existing
+ * file unless overwrite is set */
+const char *open_output_file(const char *name, struct audio_file *input_file, int overwrite);
+
+/* Queue samples for the output file without blocking, they
+ * are written to disk by a separate thread. Samples are
+ * dropped if writing falls behind by more than two seconds */
 void write_to_output_file(float *data, size_t size);
 
+/* Queue samples for the output file, waiting for the writer
+ * thread instead of dropping samples. Not for the audio
+ * thread */
+void write_to_output_file_wait(float *data, size_t size);
+
 #endif
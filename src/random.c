@@ -0,0 +1,86 @@
+#include "random.h"
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+/* splitmix64, used to expand the seed in to the full state */
+static uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+void rng_seed(struct rng *rng, uint64_t seed)
+{
+  for (int i = 0; i < 4; ++i) {
+    rng->s[i] = splitmix64(&seed);
+  }
+}
+
+uint64_t rng_next(struct rng *rng)
+{
+  uint64_t *s = rng->s;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
+}
+
+void rng_fill(struct rng *rng, uint64_t *buf, size_t n)
+{
+  /* Keep the state in registers for the whole batch */
+  uint64_t s0 = rng->s[0], s1 = rng->s[1], s2 = rng->s[2], s3 = rng->s[3];
+
+  for (size_t i = 0; i < n; ++i) {
+    buf[i] = rotl(s1 * 5, 7) * 9;
+    uint64_t t = s1 << 17;
+    s2 ^= s0;
+    s3 ^= s1;
+    s1 ^= s2;
+    s0 ^= s3;
+    s2 ^= t;
+    s3 = rotl(s3, 45);
+  }
+
+  rng->s[0] = s0;
+  rng->s[1] = s1;
+  rng->s[2] = s2;
+  rng->s[3] = s3;
+}
+
+void rng_jump(struct rng *rng)
+{
+  static const uint64_t jump[4] = {
+    0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+    0xa9582618e03fc9aa, 0x39abdc4529b1661c,
+  };
+  uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+  for (int i = 0; i < 4; ++i) {
+    for (int b = 0; b < 64; ++b) {
+      if (jump[i] & (uint64_t) 1 << b) {
+        s0 ^= rng->s[0];
+        s1 ^= rng->s[1];
+        s2 ^= rng->s[2];
+        s3 ^= rng->s[3];
+      }
+      rng_next(rng);
+    }
+  }
+
+  rng->s[0] = s0;
+  rng->s[1] = s1;
+  rng->s[2] = s2;
+  rng->s[3] = s3;
+}
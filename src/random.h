@@ -0,0 +1,38 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* xoshiro256** pseudo random number generator */
+struct rng {
+  uint64_t s[4];
+};
+
+/* Seed the generator, any seed is valid */
+void rng_seed(struct rng *rng, uint64_t seed);
+
+uint64_t rng_next(struct rng *rng);
+
+/* Generate n numbers at once */
+void rng_fill(struct rng *rng, uint64_t *buf, size_t n);
+
+/* Advance the generator by 2^128 numbers. Used to split
+ * one seed in to non-overlapping streams */
+void rng_jump(struct rng *rng);
+
+/* Map a random number to an integer in [min, max). Uses
+ * multiply-shift instead of modulo, the bias is at
+ * most (max - min) / 2^32 */
+static inline unsigned int rng_range(uint64_t r, unsigned int min, unsigned int max)
+{
+  return min + (unsigned int) (((r >> 32) * (uint64_t) (max - min)) >> 32);
+}
+
+/* Map a random number to a float in [0, 1) */
+static inline float rng_float(uint64_t r)
+{
+  return (float) (r >> 40) * (1.f / (float) (1 << 24));
+}
+
+#endif
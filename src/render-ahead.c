@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "log.h"
+#include "xmalloc.h"
+#include "output.h"
+#include "rt-check.h"
+#include "render-ahead.h"
+
+/* Samples synthesized at a time */
+#define RENDER_AHEAD_CHUNK 1024
+
+/* SCHED_FIFO priority of the thread, if allowed */
+#define RENDER_AHEAD_PRIORITY 10
+
+struct render_ahead {
+  struct synthesizer   *syn;
+  float                *ring;
+  size_t                size;
+  size_t                chunk;
+  atomic_size_t         head;       /* Next sample read by the stream */
+  atomic_size_t         tail;       /* Next sample rendered */
+  atomic_ulong          underruns;
+  atomic_int            quit;
+  atomic_int            sleeping;   /* Thread waits for room in the ring */
+  _Atomic uint32_t      wakeups;    /* Incremented to wake the thread */
+  pthread_t             thread;
+};
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t val)
+{
+  syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr)
+{
+  syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Room for another chunk */
+static int has_room(struct render_ahead *ra)
+{
+  return ra->size - (atomic_load_explicit(&ra->tail, memory_order_acquire) -
+                     atomic_load(&ra->head)) >= ra->chunk;
+}
+
+static void wake(struct render_ahead *ra)
+{
+  atomic_fetch_add_explicit(&ra->wakeups, 1, memory_order_release);
+  futex_wake(&ra->wakeups);
+}
+
+/* Render chunks until the ring is full */
+static void fill(struct render_ahead *ra)
+{
+  size_t tail = atomic_load_explicit(&ra->tail, memory_order_relaxed);
+
+  while (ra->size - (tail - atomic_load_explicit(&ra->head, memory_order_acquire)) >= ra->chunk) {
+    synthesize(ra->syn, ra->chunk);
+    float *data = synthesizer_get_data_ptr(ra->syn);
+    write_to_output_file(data, ra->chunk);
+
+    size_t offset = tail % ra->size;
+    size_t n = ra->chunk < ra->size - offset ? ra->chunk : ra->size - offset;
+    memcpy(ra->ring + offset, data, sizeof(*data) * n);
+    memcpy(ra->ring, data + n, sizeof(*data) * (ra->chunk - n));
+
+    tail += ra->chunk;
+    atomic_store_explicit(&ra->tail, tail, memory_order_release);
+  }
+}
+
+static void *render_main(void *arg)
+{
+  struct render_ahead *ra = arg;
+
+  while (!atomic_load_explicit(&ra->quit, memory_order_acquire)) {
+    rt_enter();
+    fill(ra);
+
+    unsigned long underruns = atomic_exchange_explicit(&ra->underruns, 0, memory_order_relaxed);
+    if (underruns) {
+      log_warn_async("Render thread fell behind %lu times", underruns);
+    }
+    rt_leave();
+
+    /* Sleep until the stream has read a chunk. Either the
+     * stream sees the thread sleeping, or the thread sees
+     * the room the stream made */
+    uint32_t wakeups = atomic_load_explicit(&ra->wakeups, memory_order_acquire);
+    atomic_store(&ra->sleeping, 1);
+    if (!has_room(ra) && !atomic_load_explicit(&ra->quit, memory_order_acquire)) {
+      futex_wait(&ra->wakeups, wakeups);
+    }
+    atomic_store(&ra->sleeping, 0);
+  }
+
+  return NULL;
+}
+
+struct render_ahead *create_render_ahead(struct synthesizer *syn, size_t size, int cpu)
+{
+  struct render_ahead *ra = xcalloc(1, sizeof(*ra));
+  int err;
+
+  ra->syn = syn;
+  ra->size = size;
+  ra->chunk = size < RENDER_AHEAD_CHUNK ? size : RENDER_AHEAD_CHUNK;
+  ra->ring = xcalloc(size, sizeof(*ra->ring));
+  atomic_init(&ra->head, 0);
+  atomic_init(&ra->tail, 0);
+  atomic_init(&ra->underruns, 0);
+  atomic_init(&ra->quit, 0);
+  atomic_init(&ra->sleeping, 0);
+  atomic_init(&ra->wakeups, 0);
+
+  synthesizer_reserve(syn, ra->chunk, 0);
+  fill(ra);
+
+  if (pthread_create(&ra->thread, NULL, render_main, ra) != 0) {
+    free(ra->ring);
+    free(ra);
+    return NULL;
+  }
+
+  struct sched_param param = {
+    .sched_priority = RENDER_AHEAD_PRIORITY,
+  };
+  err = pthread_setschedparam(ra->thread, SCHED_FIFO, &param);
+  if (err != 0) {
+    log_warn("Render thread runs without real-time priority: %s", strerror(err));
+  }
+
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    err = pthread_setaffinity_np(ra->thread, sizeof(set), &set);
+    if (err != 0) {
+      log_warn("Failed to pin render thread to CPU %d: %s", cpu, strerror(err));
+    }
+  }
+
+  return ra;
+}
+
+void free_render_ahead(struct render_ahead *ra)
+{
+  atomic_store_explicit(&ra->quit, 1, memory_order_release);
+  wake(ra);
+  pthread_join(ra->thread, NULL);
+
+  free(ra->ring);
+  free(ra);
+}
+
+size_t render_ahead_peek(struct render_ahead *ra, const float **data, size_t n)
+{
+  size_t head = atomic_load_explicit(&ra->head, memory_order_relaxed);
+  size_t available = atomic_load_explicit(&ra->tail, memory_order_acquire) - head;
+  size_t offset = head % ra->size;
+
+  if (n > available) {
+    n = available;
+  }
+  if (n > ra->size - offset) {
+    n = ra->size - offset;
+  }
+
+  *data = ra->ring + offset;
+  return n;
+}
+
+void render_ahead_consume(struct render_ahead *ra, size_t n)
+{
+  atomic_fetch_add(&ra->head, n);
+
+  /* Only wakes once per chunk read, the thread
+   * doesn't sleep again before filling the ring */
+  if (atomic_load(&ra->sleeping) && has_room(ra) &&
+      atomic_exchange_explicit(&ra->sleeping, 0, memory_order_relaxed)) {
+    wake(ra);
+  }
+}
+
+size_t render_ahead_available(struct render_ahead *ra)
+{
+  return atomic_load_explicit(&ra->tail, memory_order_acquire) -
+         atomic_load_explicit(&ra->head, memory_order_acquire);
+}
+
+void render_ahead_underrun(struct render_ahead *ra)
+{
+  atomic_fetch_add_explicit(&ra->underruns, 1, memory_order_relaxed);
+}
@@ -0,0 +1,38 @@
+#ifndef RENDER_AHEAD_H
+#define RENDER_AHEAD_H
+
+#include <stddef.h>
+
+#include "synthesizer.h"
+
+/* Renders on a thread of its own, ahead of the stream, in to
+ * a single producer, single consumer ring. The stream then
+ * only copies out of the ring, spikes in rendering time are
+ * absorbed as long as the ring doesn't run empty */
+struct render_ahead;
+
+/* Buffer size samples ahead. The ring is filled before the
+ * thread starts, so the first read doesn't run empty. The
+ * thread runs with real-time priority if allowed, on the
+ * given CPU unless cpu is negative. Returns NULL if the
+ * thread could not be started */
+struct render_ahead *create_render_ahead(struct synthesizer *syn, size_t size, int cpu);
+
+/* Stop the thread, the synthesizer is left as is */
+void free_render_ahead(struct render_ahead *ra);
+
+/* Contiguous rendered samples at the read position, at
+ * most n. Returns the number of samples at *data */
+size_t render_ahead_peek(struct render_ahead *ra, const float **data, size_t n);
+
+/* Release n samples returned by render_ahead_peek */
+void render_ahead_consume(struct render_ahead *ra, size_t n);
+
+/* Rendered samples waiting to be read */
+size_t render_ahead_available(struct render_ahead *ra);
+
+/* Count a read the ring could not satisfy, reported
+ * later by the render thread */
+void render_ahead_underrun(struct render_ahead *ra);
+
+#endif
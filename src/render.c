@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "output.h"
+#include "xmalloc.h"
+#include "render.h"
+
+/* Frames synthesized at a time */
+#define RENDER_BLOCK 16384
+
+static char s_errorbuf[512] = {0};
+
+/* Look a profile up by index or name */
+static int find_profile(const char *s, struct config *cfg, size_t *index)
+{
+  char *end;
+  unsigned long i = strtoul(s, &end, 10);
+
+  if (*s != 0 && *end == 0) {
+    if (i >= cfg->size) {
+      return -1;
+    }
+    *index = i;
+    return 0;
+  }
+
+  for (i = 0; i < cfg->size; ++i) {
+    if (cfg->profiles[i].name && strcmp(cfg->profiles[i].name, s) == 0) {
+      *index = i;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+const char *parse_schedule(const char *s, struct config *cfg, struct schedule *schedule)
+{
+  char *text = strdup(s);
+  char *save;
+  size_t capac = 8;
+
+  schedule->entries = xmalloc(sizeof(*schedule->entries) * capac);
+  schedule->size = 0;
+
+  for (char *tok = strtok_r(text, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    char *profile = strchr(tok, ':');
+    char *end;
+
+    if (profile == NULL) {
+      snprintf(s_errorbuf, sizeof(s_errorbuf),
+               "Expected <seconds>:<profile> in '%s'", tok);
+      goto fail;
+    }
+    *profile++ = 0;
+
+    double time = strtod(tok, &end);
+    if (*tok == 0 || *end != 0 || time < 0.) {
+      snprintf(s_errorbuf, sizeof(s_errorbuf), "Invalid time '%s'", tok);
+      goto fail;
+    }
+    if (schedule->size && time <= schedule->entries[schedule->size - 1].time) {
+      snprintf(s_errorbuf, sizeof(s_errorbuf),
+               "Time %s is not after the previous switch", tok);
+      goto fail;
+    }
+
+    size_t index;
+    if (find_profile(profile, cfg, &index) < 0) {
+      snprintf(s_errorbuf, sizeof(s_errorbuf), "No profile '%s'", profile);
+      goto fail;
+    }
+
+    if (schedule->size == capac) {
+      capac *= 2;
+      schedule->entries = xrealloc(schedule->entries, sizeof(*schedule->entries) * capac);
+    }
+    schedule->entries[schedule->size].time = time;
+    schedule->entries[schedule->size].profile = index;
+    schedule->size++;
+  }
+
+  free(text);
+  return NULL;
+
+fail:
+  free(text);
+  free_schedule(schedule);
+  return s_errorbuf;
+}
+
+void free_schedule(struct schedule *schedule)
+{
+  free(schedule->entries);
+  schedule->entries = NULL;
+  schedule->size = 0;
+}
+
+int parse_pitch_classes(const char *s, unsigned int *mask)
+{
+  *mask = 0;
+
+  while (*s) {
+    char *end;
+    unsigned long pitch = strtoul(s, &end, 10);
+
+    if (end == s || pitch > 11 || (*end != 0 && *end != ',')) {
+      return -1;
+    }
+    *mask |= 1u << pitch;
+
+    s = *end ? end + 1 : end;
+  }
+
+  return *mask ? 0 : -1;
+}
+
+double render_offline(struct synthesizer *syn, struct config *cfg,
+                      const struct schedule *schedule, unsigned int mask,
+                      unsigned int samplerate, unsigned int channels, double seconds)
+{
+  size_t frames = (size_t) (seconds * samplerate + .5);
+  size_t next = 0;
+  struct timespec start, end;
+
+  for (int pitch = 0; pitch < 12; ++pitch) {
+    if (mask & 1u << pitch) {
+      synthesizer_note_on(syn, pitch);
+    }
+  }
+
+  /* Nothing is playing yet, switches at the start
+   * don't need to interpolate */
+  if (schedule->size && schedule->entries[0].time == 0.) {
+    set_synthesizer_profile(syn, &cfg->profiles[schedule->entries[0].profile], 1);
+    next++;
+  }
+
+  synthesizer_reserve(syn, (size_t) RENDER_BLOCK * channels, 0);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t t = 0; t < frames;) {
+    size_t length = frames - t < RENDER_BLOCK ? frames - t : RENDER_BLOCK;
+
+    /* Profiles change between blocks, so blocks are
+     * cut short at the frame of the next switch */
+    if (next < schedule->size) {
+      const struct schedule_entry *e = &schedule->entries[next];
+      size_t at = (size_t) (e->time * samplerate + .5);
+
+      if (at <= t) {
+        const char *name = cfg->profiles[e->profile].name;
+        if (name) {
+          log_info("%.3fs: switching to profile %zu (%s)", e->time, e->profile, name);
+        } else {
+          log_info("%.3fs: switching to profile %zu", e->time, e->profile);
+        }
+        set_synthesizer_profile(syn, &cfg->profiles[e->profile], 0);
+        next++;
+        continue;
+      }
+      if (at - t < length) {
+        length = at - t;
+      }
+    }
+
+    synthesize(syn, length * channels);
+    write_to_output_file_wait(synthesizer_get_data_ptr(syn), length * channels);
+    t += length;
+
+    /* No event loop prints queued messages while rendering */
+    log_flush_async();
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double rendered = (double) frames / samplerate;
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+  double speedup = elapsed > 0. ? rendered / elapsed : 0.;
+
+  log_info("Rendered %.3fs in %.3fs, %.1fx real time", rendered, elapsed, speedup);
+
+  return speedup;
+}
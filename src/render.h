@@ -0,0 +1,40 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+
+#include "config.h"
+#include "synthesizer.h"
+
+/* Profile switch at a point in time of an offline render */
+struct schedule_entry {
+  double         time;                   /* Seconds from the start of the render */
+  size_t         profile;                /* Index of the profile in the configuration */
+};
+
+struct schedule {
+  struct schedule_entry *entries;
+  size_t          size;
+};
+
+/* Parse a schedule of the form "<seconds>:<profile>,...",
+ * where profile is an index or name in cfg and the times
+ * are increasing. Returns an error message on failure */
+const char *parse_schedule(const char *s, struct config *cfg, struct schedule *schedule);
+
+void free_schedule(struct schedule *schedule);
+
+/* Parse a comma separated list of pitch classes (0-11) in
+ * to a mask. Returns -1 on failure */
+int parse_pitch_classes(const char *s, unsigned int *mask);
+
+/* Render seconds of audio to the output file as fast as
+ * possible, holding the pitch classes in mask and switching
+ * profiles at the times in schedule. The profile at time 0
+ * is set right away. Returns the achieved speed-up over
+ * real time */
+double render_offline(struct synthesizer *syn, struct config *cfg,
+                      const struct schedule *schedule, unsigned int mask,
+                      unsigned int samplerate, unsigned int channels, double seconds);
+
+#endif
@@ -0,0 +1,202 @@
+#include "rt-check.h"
+
+/* Nesting depth of rt_enter on this thread */
+static _Thread_local int s_rt_depth = 0;
+
+void rt_enter(void)
+{
+  s_rt_depth++;
+}
+
+void rt_leave(void)
+{
+  s_rt_depth--;
+}
+
+#ifdef RT_CHECK
+
+/* The checked functions are wrapped at link time with
+ * -Wl,--wrap, so only calls made from this program are seen,
+ * not calls libraries make internally. Futex waits and wakes
+ * of the worker pool are made with syscall() and are allowed */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <sndfile.h>
+
+enum rt_call {
+  RT_MALLOC,
+  RT_CALLOC,
+  RT_REALLOC,
+  RT_FREE,
+  RT_POSIX_MEMALIGN,
+  RT_MUTEX_LOCK,
+  RT_READ,
+  RT_WRITE,
+  RT_PRINTF,
+  RT_VPRINTF,
+  RT_SF_WRITE_FLOAT,
+  RT_NANOSLEEP,
+  RT_CALL_COUNT
+};
+
+static const char *s_call_names[RT_CALL_COUNT] = {
+  "malloc",
+  "calloc",
+  "realloc",
+  "free",
+  "posix_memalign",
+  "pthread_mutex_lock",
+  "read",
+  "write",
+  "printf",
+  "vprintf",
+  "sf_write_float",
+  "nanosleep",
+};
+
+static atomic_ulong s_counts[RT_CALL_COUNT];
+
+ssize_t __real_write(int fd, const void *buf, size_t count);
+
+/* Report the first call of a function on a real-time thread */
+static void check(enum rt_call call)
+{
+  if (s_rt_depth <= 0) {
+    return;
+  }
+
+  if (atomic_fetch_add_explicit(&s_counts[call], 1, memory_order_relaxed) != 0) {
+    return;
+  }
+
+  /* Calls made while reporting are not checked */
+  int depth = s_rt_depth;
+  s_rt_depth = 0;
+
+  char buf[128];
+  int n = snprintf(buf, sizeof(buf), "rt-check: %s called on a real-time thread\r\n",
+                   s_call_names[call]);
+  (void) __real_write(STDERR_FILENO, buf, (size_t) n);
+
+  void *frames[32];
+  int num_frames = backtrace(frames, 32);
+  backtrace_symbols_fd(frames, num_frames, STDERR_FILENO);
+
+  if (getenv("RT_CHECK_ABORT")) {
+    abort();
+  }
+
+  s_rt_depth = depth;
+}
+
+__attribute__((destructor))
+static void report(void)
+{
+  for (int i = 0; i < RT_CALL_COUNT; ++i) {
+    unsigned long count = atomic_load_explicit(&s_counts[i], memory_order_relaxed);
+    if (count) {
+      fprintf(stderr, "rt-check: %s called %lu times on a real-time thread\r\n",
+              s_call_names[i], count);
+    }
+  }
+}
+
+void *__real_malloc(size_t size);
+void *__wrap_malloc(size_t size)
+{
+  check(RT_MALLOC);
+  return __real_malloc(size);
+}
+
+void *__real_calloc(size_t nmemb, size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+  check(RT_CALLOC);
+  return __real_calloc(nmemb, size);
+}
+
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  check(RT_REALLOC);
+  return __real_realloc(ptr, size);
+}
+
+void __real_free(void *ptr);
+void __wrap_free(void *ptr)
+{
+  check(RT_FREE);
+  __real_free(ptr);
+}
+
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+  check(RT_POSIX_MEMALIGN);
+  return __real_posix_memalign(ptr, alignment, size);
+}
+
+int __real_pthread_mutex_lock(pthread_mutex_t *mutex);
+int __wrap_pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+  check(RT_MUTEX_LOCK);
+  return __real_pthread_mutex_lock(mutex);
+}
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+  check(RT_READ);
+  return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+  check(RT_WRITE);
+  return __real_write(fd, buf, count);
+}
+
+int __real_vprintf(const char *fmt, va_list ap);
+int __wrap_vprintf(const char *fmt, va_list ap)
+{
+  check(RT_VPRINTF);
+  return __real_vprintf(fmt, ap);
+}
+
+int __wrap_printf(const char *fmt, ...)
+{
+  va_list ap;
+  int ret;
+
+  check(RT_PRINTF);
+
+  va_start(ap, fmt);
+  ret = __real_vprintf(fmt, ap);
+  va_end(ap);
+
+  return ret;
+}
+
+sf_count_t __real_sf_write_float(SNDFILE *file, const float *ptr, sf_count_t items);
+sf_count_t __wrap_sf_write_float(SNDFILE *file, const float *ptr, sf_count_t items)
+{
+  check(RT_SF_WRITE_FLOAT);
+  return __real_sf_write_float(file, ptr, items);
+}
+
+int __real_nanosleep(const struct timespec *req, struct timespec *rem);
+int __wrap_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+  check(RT_NANOSLEEP);
+  return __real_nanosleep(req, rem);
+}
+
+#endif
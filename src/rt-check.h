@@ -0,0 +1,13 @@
+#ifndef RT_CHECK_H
+#define RT_CHECK_H
+
+/* Mark the calling thread as real-time between rt_enter and
+ * rt_leave. Built with RT_CHECK (make rtcheck), allocations,
+ * blocking locks, file I/O and printing on a real-time thread
+ * are reported on stderr with a backtrace, once per function.
+ * With RT_CHECK_ABORT set in the environment the program
+ * aborts instead. Without RT_CHECK the marks do nothing */
+void rt_enter(void);
+void rt_leave(void);
+
+#endif
@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "xmalloc.h"
+#include "scheduler.h"
+
+#define BUCKET_MASK (SCHEDULER_BUCKETS - 1)
+
+static inline size_t bucket(uint64_t wake)
+{
+  return (size_t) (wake >> SCHEDULER_RESOLUTION) & BUCKET_MASK;
+}
+
+void init_scheduler(struct scheduler *s)
+{
+  memset(s, 0, sizeof(*s));
+
+  for (size_t i = 0; i < SCHEDULER_BUCKETS; ++i) {
+    s->head[i] = SCHEDULER_NONE;
+  }
+}
+
+void free_scheduler(struct scheduler *s)
+{
+  free(s->next);
+  free(s->prev);
+  free(s->wake);
+  free(s->queued);
+  init_scheduler(s);
+}
+
+void scheduler_reserve(struct scheduler *s, size_t n)
+{
+  if (n <= s->capac) {
+    return;
+  }
+
+  s->next = xrealloc(s->next, n * sizeof(*s->next));
+  s->prev = xrealloc(s->prev, n * sizeof(*s->prev));
+  s->wake = xrealloc(s->wake, n * sizeof(*s->wake));
+  s->queued = xrealloc(s->queued, n * sizeof(*s->queued));
+
+  memset(s->wake + s->capac, 0, (n - s->capac) * sizeof(*s->wake));
+  memset(s->queued + s->capac, 0, (n - s->capac) * sizeof(*s->queued));
+  s->capac = n;
+}
+
+void scheduler_swap(struct scheduler *s, struct scheduler *larger)
+{
+  size_t n = s->capac;
+
+  memcpy(larger->next, s->next, n * sizeof(*s->next));
+  memcpy(larger->prev, s->prev, n * sizeof(*s->prev));
+  memcpy(larger->wake, s->wake, n * sizeof(*s->wake));
+  memcpy(larger->queued, s->queued, n * sizeof(*s->queued));
+
+  uint32_t *next = s->next;
+  uint32_t *prev = s->prev;
+  uint64_t *wake = s->wake;
+  unsigned char *queued = s->queued;
+
+  s->next = larger->next;
+  s->prev = larger->prev;
+  s->wake = larger->wake;
+  s->queued = larger->queued;
+  s->capac = larger->capac;
+
+  larger->next = next;
+  larger->prev = prev;
+  larger->wake = wake;
+  larger->queued = queued;
+  larger->capac = n;
+}
+
+void schedule_slot(struct scheduler *s, unsigned int slot, uint64_t wake)
+{
+  size_t b = bucket(wake);
+
+  s->wake[slot] = wake;
+  s->queued[slot] = 1;
+  s->prev[slot] = SCHEDULER_NONE;
+  s->next[slot] = s->head[b];
+  if (s->head[b] != SCHEDULER_NONE) {
+    s->prev[s->head[b]] = slot;
+  }
+  s->head[b] = slot;
+}
+
+void unschedule_slot(struct scheduler *s, unsigned int slot)
+{
+  if (!s->queued[slot]) {
+    return;
+  }
+
+  if (s->prev[slot] == SCHEDULER_NONE) {
+    s->head[bucket(s->wake[slot])] = s->next[slot];
+  } else {
+    s->next[s->prev[slot]] = s->next[slot];
+  }
+
+  if (s->next[slot] != SCHEDULER_NONE) {
+    s->prev[s->next[slot]] = s->prev[slot];
+  }
+
+  s->queued[slot] = 0;
+}
+
+void advance_scheduler(struct scheduler *s, uint64_t time, scheduler_fn fn, void *arg)
+{
+  if (time <= s->time) {
+    return;
+  }
+
+  /* Visit every bucket the time span touches, at most once */
+  uint64_t first = s->time >> SCHEDULER_RESOLUTION;
+  uint64_t last = (time - 1) >> SCHEDULER_RESOLUTION;
+  if (last - first >= SCHEDULER_BUCKETS) {
+    last = first + SCHEDULER_BUCKETS - 1;
+  }
+
+  for (uint64_t tick = first; tick <= last; ++tick) {
+    uint32_t slot = s->head[tick & BUCKET_MASK];
+
+    while (slot != SCHEDULER_NONE) {
+      uint32_t next = s->next[slot];
+      if (s->wake[slot] < time) {
+        unschedule_slot(s, slot);
+        fn(arg, slot);
+      }
+      slot = next;
+    }
+  }
+
+  s->time = time;
+}
@@ -0,0 +1,51 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Timing wheel of SCHEDULER_BUCKETS buckets, each spanning
+ * 2^SCHEDULER_RESOLUTION samples. Slots waking further ahead
+ * than one turn stay in their bucket until their turn comes */
+#define SCHEDULER_BITS       8
+#define SCHEDULER_BUCKETS    (1 << SCHEDULER_BITS)
+#define SCHEDULER_RESOLUTION 6
+
+#define SCHEDULER_NONE UINT32_MAX
+
+/* Called for every slot due */
+typedef void (*scheduler_fn)(void *arg, unsigned int slot);
+
+struct scheduler {
+  uint32_t       head[SCHEDULER_BUCKETS]; /* First slot in each bucket */
+  uint32_t      *next;         /* Doubly linked slots within a bucket */
+  uint32_t      *prev;
+  uint64_t      *wake;         /* Sample time each slot wakes at */
+  unsigned char *queued;       /* Slot is in the wheel */
+  size_t         capac;
+  uint64_t       time;         /* Slots waking before this are popped */
+};
+
+void init_scheduler(struct scheduler *s);
+void free_scheduler(struct scheduler *s);
+
+/* Grow slot arrays to hold at least n slots */
+void scheduler_reserve(struct scheduler *s, size_t n);
+
+/* Copy the slots of s in to the slot arrays of larger, which
+ * must hold at least as many, and swap the arrays. The wheel
+ * stays with s, larger ends up with the old arrays. Doesn't
+ * allocate */
+void scheduler_swap(struct scheduler *s, struct scheduler *larger);
+
+/* Wake slot at sample time wake, which must not be before the
+ * current time of the scheduler. The slot must not be queued */
+void schedule_slot(struct scheduler *s, unsigned int slot, uint64_t wake);
+
+/* Remove slot from the wheel, if queued */
+void unschedule_slot(struct scheduler *s, unsigned int slot);
+
+/* Pop every slot waking before time, in no particular order */
+void advance_scheduler(struct scheduler *s, uint64_t time, scheduler_fn fn, void *arg);
+
+#endif
@@ -13,7 +13,7 @@ struct list *list_select(struct list *l)
   const char *c = s_chars;
 
   /* Show list */
-  for (; it && c; it = it->next, c++) {
+  for (; it && *c; it = it->next, c++) {
     log_info("    \x1b[34m%c\x1b[0m: %s: %s (%d)", *c, it->description, it->name, it->index);
   }
 
@@ -31,7 +31,7 @@ struct list *list_select(struct list *l)
   c = s_chars;
 
   /* Find list entry */
-  for (; it && c && c != sel; it = it->next, c++) {
+  for (; it && *c && c != sel; it = it->next, c++) {
   }
 
   assert(it);
@@ -1,21 +1,76 @@
 #include <string.h>
+#include <limits.h>
 #include <math.h>
-#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "log.h"
 #include "xmalloc.h"
+#include "mix.h"
+#include "random.h"
+#include "worker-pool.h"
+#include "scheduler.h"
+#include "grain-cache.h"
+#include "governor.h"
+#include "triple-buffer.h"
 #include "synthesizer.h"
 
 #define PITCH_STEP 1.0594630943592953f
 
-struct slot {
-  unsigned int     offset;
-  unsigned int     length;
-  unsigned int     cooldown;
-  unsigned int     cursor;
-  float            gain;
-  float            multiplier;
-  int              reverse;
+/* Random numbers are generated in batches of this size */
+#define RANDOM_POOL_SIZE 64
+
+/* State shared by a group of MIX_LANES slots, a group is
+ * only ever touched by one worker at a time. Each group draws
+ * from its own random stream, so grains don't depend on the
+ * order slots are rendered in, or by which thread */
+struct slot_group {
+  struct rng            rng;
+  uint64_t              pool[RANDOM_POOL_SIZE];
+  size_t                index;             /* Next unused number in pool */
+  unsigned int          active;            /* Mask of slots playing or waking this period */
+  unsigned int          sleeping;          /* Mask of slots that went to sleep this period */
+  uint64_t              grains;            /* Grains started in the group */
+} __attribute__((aligned(MIX_ALIGN)));
+
+/* Offsets of cached grains are rounded down to a multiple
+ * of this, so grains at nearby offsets share an entry */
+#define GRAIN_CACHE_QUANTUM 32
+
+/* Default number of samples between profile updates while
+ * interpolating between profiles */
+#define CONTROL_PERIOD 64
+
+/* Time constant in seconds of the one-pole filter smoothing
+ * the gain of slots faded in/out by profile interpolation */
+#define SMOOTHING_TIME .01f
+
+/* Profile changes handed from the control thread to the
+ * audio thread. Only the latest is applied, each starts
+ * from the profile current at the time it is applied */
+enum control_command {
+  CONTROL_INTERPOLATE,
+  CONTROL_FADE_OUT
+};
+
+struct control {
+  enum control_command  command;
+  struct profile        profile;           /* Target of CONTROL_INTERPOLATE */
+  float                 interp_time;
+};
+
+/* Larger slot arrays allocated by the control thread for a
+ * profile with more slots than reserved. The audio thread
+ * copies its slots over between blocks and hands the old
+ * arrays back in the same struct, for the control thread
+ * to free */
+struct slot_storage {
+  struct grains         grains;
+  struct scheduler      scheduler;
+  struct slot_group    *groups;
+  size_t                groups_capac;
+  size_t                num_slots;
+  struct slot_storage  *next;              /* Retired storage */
 };
 
 struct synthesizer {
@@ -24,11 +79,11 @@ struct synthesizer {
   struct profile        target_profile;
   struct profile        source_profile;
 
-  struct slot          *slots;
+  struct grains         grains;            /* Slots, structure-of-arrays */
   size_t                num_slots;
   size_t                slots_capac;
+  const struct mix_kernels *mix;           /* Mixing kernels */
 
-  pthread_mutex_t       lock;
   size_t                fcursor;           /* Offset within audio file */
 
   float                *data;              /* Synthesized samples */
@@ -36,272 +91,1048 @@ struct synthesizer {
 
   float                 interp_time;       /* Time in seconds for profile interpolation */
   unsigned int          interp_counter;    /* Counter used for inteprolating between profiles */
+  unsigned int          control_period;    /* Samples between profile updates while interpolating */
 
-  int                   pitches[12];
-  int                   pitches_freezed[12];
-  int                   freeze_pitches;
+  float                 scaling;           /* Smoothed gain of new/old slots at the start of the control period... */
+  float                 scaling_step;      /* ...incremented by this for every sample */
+  int                   smoothing;         /* Scaling has not yet reached its target */
+
+  struct rng            rng;               /* Streams for new slot groups are split off this */
+  struct slot_group    *groups;            /* One per MIX_LANES slots */
+  size_t                groups_capac;
+  struct scheduler      scheduler;         /* Wakes slots at the end of their cooldown */
+  uint64_t              clock;             /* Sample time at the start of the block */
+
+  struct grain_cache   *cache;             /* Pre-rendered grains, NULL if disabled */
+  struct governor       governor;
+
+  struct worker_pool   *workers;           /* NULL if rendering on the calling thread only */
+  size_t                num_workers;
+  float               **partial;           /* Output of every worker but the first */
+  float                *render_out;        /* Output of the first worker */
+  size_t                render_start;      /* Samples rendered by the current job */
+  size_t                render_end;
+
+  /* Written by the control thread, never waited on
+   * by the audio thread */
+  struct triple_buffer  controls;          /* Latest struct control */
+  float                 control_interp_time;
+  _Atomic unsigned int  pitches;           /* Mask of held pitch classes */
+  atomic_int            freeze_pitches;
+  _Atomic(struct slot_storage *) pending_storage;
+  size_t                reserved_slots;    /* Slots of the pending storage, or the current */
+  size_t                reserved_groups;
+
+  /* Written by the audio thread, freed by the control thread */
+  _Atomic(struct slot_storage *) retired_storage;
+
+  /* Written by the audio thread */
+  struct triple_buffer  governor_status;   /* Latest struct governor */
+  unsigned int          pitches_freezed;   /* Pitches of the current block */
+  _Atomic uint64_t      pitch_change;      /* Start of the last block with new pitches in
+                                            * microseconds, shifted up 12 bits, or'ed with them */
 };
 
+/* Hand the governor state over to the control thread */
+static void publish_governor(struct synthesizer *syn)
+{
+  memcpy(triple_buffer_back(&syn->governor_status), &syn->governor, sizeof(struct governor));
+  triple_buffer_publish(&syn->governor_status);
+}
+
 struct synthesizer *create_synthesizer(struct audio_file *audio)
 {
   struct synthesizer *syn;
-  pthread_mutexattr_t mutexattr;
-  
+
   syn = xcalloc(1, sizeof(*syn));
   syn->af = audio;
 
   syn->num_slots = 0;
   syn->slots_capac = syn->num_slots;
-  syn->slots = NULL;
+
+  syn->mix = mix_select();
 
   syn->data_size = 4096;
   syn->data = xcalloc(sizeof(*syn->data), syn->data_size);
 
   syn->interp_time = 1.f;
+  syn->control_interp_time = syn->interp_time;
+  syn->control_period = CONTROL_PERIOD;
+  syn->scaling = 1.f;
+  syn->num_workers = 1;
+
+  init_scheduler(&syn->scheduler);
+  init_governor(&syn->governor);
+  synthesizer_set_seed(syn, 0);
 
-  pthread_mutexattr_init(&mutexattr);
-  pthread_mutex_init(&syn->lock, &mutexattr);
+  init_triple_buffer(&syn->controls, sizeof(struct control));
+  atomic_init(&syn->pitches, 0);
+  atomic_init(&syn->freeze_pitches, 0);
+  atomic_init(&syn->pitch_change, 0);
+  atomic_init(&syn->pending_storage, NULL);
+  atomic_init(&syn->retired_storage, NULL);
+
+  init_triple_buffer(&syn->governor_status, sizeof(struct governor));
+  publish_governor(syn);
 
   return syn;
 }
 
+static void free_slot_storage(struct slot_storage *storage)
+{
+  grains_free(&storage->grains);
+  free_scheduler(&storage->scheduler);
+  free(storage->groups);
+  free(storage);
+}
+
+/* Free the old arrays handed back by the audio thread */
+static void free_retired_storage(struct synthesizer *syn)
+{
+  struct slot_storage *storage = atomic_exchange_explicit(&syn->retired_storage, NULL,
+                                                          memory_order_acquire);
+
+  while (storage) {
+    struct slot_storage *next = storage->next;
+    free_slot_storage(storage);
+    storage = next;
+  }
+}
+
 void free_synthesizer(struct synthesizer *syn)
 {
-  free(syn->slots);
+  struct slot_storage *pending = atomic_load(&syn->pending_storage);
+  if (pending) {
+    free_slot_storage(pending);
+  }
+  free_retired_storage(syn);
+
+  synthesizer_set_threads(syn, 1);
+  synthesizer_set_cache_size(syn, 0);
+  grains_free(&syn->grains);
+  free(syn->groups);
+  free_scheduler(&syn->scheduler);
+  free_triple_buffer(&syn->controls);
+  free_triple_buffer(&syn->governor_status);
+  free(syn->data);
+  free(syn);
+}
+
+/* Profile interpolation factor n samples from now */
+static float profile_interp(struct synthesizer *syn, size_t n)
+{
+  if (n >= syn->interp_counter) {
+    return 1.f;
+  }
+
+  return 1.f - (float) (syn->interp_counter - n) / (syn->interp_time * (float) syn->af->samplerate);
+}
+
+/* Which way slots above the smaller slot count of the source and
+ * target profile are scaled during interpolation. 1 if they fade
+ * in, -1 if they fade out and 0 if the slot counts are equal */
+static int scaling_sign(struct synthesizer *syn)
+{
+  if (syn->source_profile.num_slots < syn->target_profile.num_slots) {
+    return 1;
+  } else if (syn->source_profile.num_slots > syn->target_profile.num_slots) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Unsmoothed scaling of new/old slots n samples from now */
+static float scaling_target(struct synthesizer *syn, size_t n)
+{
+  switch (scaling_sign(syn)) {
+  case 1:
+    return profile_interp(syn, n);
+  case -1:
+    return 1.f - profile_interp(syn, n);
+  default:
+    return 1.f;
+  }
+}
+
+/* Start interpolating from the current profile to target */
+static void start_interpolation(struct synthesizer *syn, const struct profile *target)
+{
+  int sign = scaling_sign(syn);
+  memcpy(&syn->source_profile, &syn->profile, sizeof(struct profile));
+  memcpy(&syn->target_profile, target, sizeof(struct profile));
+  syn->interp_counter = (unsigned int) (syn->af->samplerate * syn->interp_time);
+
+  /* Other slots are scaled if the direction changed, so the
+   * smoothed scaling restarts. Otherwise it glides on */
+  if (scaling_sign(syn) != sign) {
+    syn->scaling = scaling_target(syn, 0);
+    syn->smoothing = 0;
+  }
+}
+
+/* Apply the latest profile change of the control thread */
+static void apply_control(struct synthesizer *syn)
+{
+  if (!triple_buffer_update(&syn->controls)) {
+    return;
+  }
+
+  const struct control *control = triple_buffer_front(&syn->controls);
+  struct profile target;
+
+  syn->interp_time = control->interp_time;
+
+  switch (control->command) {
+  case CONTROL_INTERPOLATE:
+    start_interpolation(syn, &control->profile);
+    break;
+  case CONTROL_FADE_OUT:
+    memcpy(&target, &syn->profile, sizeof(struct profile));
+    target.min_gain = 0.f;
+    target.max_gain = 0.f;
+    start_interpolation(syn, &target);
+    break;
+  }
+}
+
+/* Hand a profile change over to the audio thread */
+static void publish_control(struct synthesizer *syn, enum control_command command,
+                            const struct profile *profile)
+{
+  struct control *control = triple_buffer_back(&syn->controls);
+
+  control->command = command;
+  if (profile) {
+    memcpy(&control->profile, profile, sizeof(struct profile));
+  }
+  control->interp_time = syn->control_interp_time;
+
+  triple_buffer_publish(&syn->controls);
+}
+
+/* Give a slot group the next stream of the generator */
+static void seed_slot_group(struct synthesizer *syn, struct slot_group *group)
+{
+  group->rng = syn->rng;
+  rng_jump(&syn->rng);
+
+  /* Force a refill on next use */
+  group->index = RANDOM_POOL_SIZE;
+}
+
+static void init_slot_groups(struct synthesizer *syn, struct slot_group *groups,
+                             size_t first, size_t last)
+{
+  for (size_t i = first; i < last; ++i) {
+    seed_slot_group(syn, &groups[i]);
+    groups[i].active = 0;
+    groups[i].sleeping = 0;
+    groups[i].grains = 0;
+  }
+}
+
+/* Allocate storage for num_slots slots, from the control
+ * thread while the audio thread renders */
+static void grow_slots(struct synthesizer *syn, size_t num_slots)
+{
+  free_retired_storage(syn);
+
+  if (num_slots <= syn->reserved_slots) {
+    return;
+  }
+
+  /* Storage not yet taken over is replaced, new groups are
+   * seeded in the same order either way */
+  struct slot_storage *old = atomic_exchange_explicit(&syn->pending_storage, NULL,
+                                                      memory_order_relaxed);
+  struct slot_storage *storage = xcalloc(1, sizeof(*storage));
+
+  grains_reserve(&storage->grains, num_slots);
+  init_scheduler(&storage->scheduler);
+  scheduler_reserve(&storage->scheduler, storage->grains.capac);
+  storage->groups_capac = storage->grains.capac / MIX_LANES;
+  storage->groups = xaligned_alloc(MIX_ALIGN, storage->groups_capac * sizeof(*storage->groups));
+  storage->num_slots = num_slots;
+
+  if (old) {
+    memcpy(storage->groups, old->groups, old->groups_capac * sizeof(*old->groups));
+    free_slot_storage(old);
+  }
+  init_slot_groups(syn, storage->groups, syn->reserved_groups, storage->groups_capac);
+
+  syn->reserved_slots = num_slots;
+  syn->reserved_groups = storage->groups_capac;
+
+  atomic_store_explicit(&syn->pending_storage, storage, memory_order_release);
+}
+
+/* Take over storage grown by the control thread, between
+ * blocks. Copies the slots, never allocates */
+static void take_slot_storage(struct synthesizer *syn)
+{
+  struct slot_storage *storage = atomic_exchange_explicit(&syn->pending_storage, NULL,
+                                                          memory_order_acquire);
+
+  if (!storage) {
+    return;
+  }
+
+  grains_swap(&syn->grains, &storage->grains);
+  scheduler_swap(&syn->scheduler, &storage->scheduler);
+
+  struct slot_group *groups = syn->groups;
+  size_t groups_capac = syn->groups_capac;
+  memcpy(storage->groups, groups, groups_capac * sizeof(*groups));
+  syn->groups = storage->groups;
+  syn->groups_capac = storage->groups_capac;
+  storage->groups = groups;
+  storage->groups_capac = groups_capac;
+
+  syn->slots_capac = storage->num_slots;
+
+  /* Hand the old arrays back */
+  storage->next = atomic_load_explicit(&syn->retired_storage, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&syn->retired_storage, &storage->next, storage,
+                                                memory_order_release, memory_order_relaxed));
 }
 
 void set_synthesizer_profile(struct synthesizer *syn, struct profile *profile, int set_now)
 {
   if (set_now) {
     memcpy(&syn->profile, profile, sizeof(struct profile));
+    synthesizer_reserve(syn, 0, profile->num_slots);
   } else {
-    memcpy(&syn->target_profile, profile, sizeof(struct profile));
-    memcpy(&syn->source_profile, &syn->profile, sizeof(struct profile));
-    syn->interp_counter = (unsigned int) (syn->af->samplerate * syn->interp_time);
+    grow_slots(syn, profile->num_slots);
+    publish_control(syn, CONTROL_INTERPOLATE, profile);
+  }
+}
+
+void synthesizer_set_seed(struct synthesizer *syn, uint64_t seed)
+{
+  rng_seed(&syn->rng, seed);
+
+  for (size_t i = 0; i < syn->groups_capac; ++i) {
+    seed_slot_group(syn, &syn->groups[i]);
   }
 }
 
+/* Make room for n slot groups */
+static void reserve_slot_groups(struct synthesizer *syn, size_t n)
+{
+  struct slot_group *groups;
+
+  if (n <= syn->groups_capac) {
+    return;
+  }
+
+  groups = xaligned_alloc(MIX_ALIGN, n * sizeof(*groups));
+  if (syn->groups) {
+    memcpy(groups, syn->groups, syn->groups_capac * sizeof(*groups));
+  }
+  free(syn->groups);
+  syn->groups = groups;
+
+  init_slot_groups(syn, syn->groups, syn->groups_capac, n);
+  syn->groups_capac = n;
+  syn->reserved_groups = n;
+}
+
+void synthesizer_reserve(struct synthesizer *syn, size_t length, size_t num_slots)
+{
+  if (length > syn->data_size) {
+    syn->data = xrealloc(syn->data, sizeof(*syn->data) * length);
+    for (size_t i = 0; i + 1 < syn->num_workers; ++i) {
+      syn->partial[i] = xrealloc(syn->partial[i], sizeof(*syn->partial[i]) * length);
+    }
+    syn->data_size = length;
+  }
+
+  if (num_slots > syn->slots_capac) {
+    grains_reserve(&syn->grains, num_slots);
+    reserve_slot_groups(syn, syn->grains.capac / MIX_LANES);
+    scheduler_reserve(&syn->scheduler, syn->grains.capac);
+    syn->slots_capac = num_slots;
+    syn->reserved_slots = num_slots;
+  }
+}
+
+uint64_t synthesizer_get_grain_count(struct synthesizer *syn)
+{
+  uint64_t grains = 0;
+
+  for (size_t i = 0; i < syn->groups_capac; ++i) {
+    grains += syn->groups[i].grains;
+  }
+
+  return grains;
+}
+
+size_t synthesizer_get_max_length(struct synthesizer *syn)
+{
+  return syn->data_size;
+}
+
+/* Take the next number from the random pool */
+static uint64_t next_random(struct slot_group *group)
+{
+  if (group->index == RANDOM_POOL_SIZE) {
+    rng_fill(&group->rng, group->pool, RANDOM_POOL_SIZE);
+    group->index = 0;
+  }
+
+  return group->pool[group->index++];
+}
+
 /* Generate a random integer within a range */
-static unsigned int randr(unsigned int min, unsigned int max)
+static unsigned int randr(struct slot_group *group, unsigned int min, unsigned int max)
 {
-  return min + rand() % (max - min);
+  return rng_range(next_random(group), min, max);
 }
 
 /* Generate a random float within a range */
-static float randf(float min, float max)
+static float randf(struct slot_group *group, float min, float max)
 {
-  return min + (max - min) * (float) rand() / (float) RAND_MAX;
+  return min + (max - min) * rng_float(next_random(group));
 }
 
-static void init_slot(struct synthesizer *syn, struct slot *slot)
+/* Generate a new grain in a slot. fcursor is the position
+ * within the audio file at the time the grain is created */
+static void init_slot(struct synthesizer *syn, size_t index,
+                      const struct profile *profile, size_t fcursor)
 {
-  if (!syn->freeze_pitches)
-    memcpy(syn->pitches_freezed, syn->pitches, sizeof(syn->pitches_freezed));
+  struct grains *g = &syn->grains;
+  struct slot_group *group = &syn->groups[index / MIX_LANES];
+
+  group->grains++;
+
+  if (g->cached[index]) {
+    grain_cache_release(syn->cache, g->cached[index]);
+    g->cached[index] = NULL;
+  }
 
   /* Generate a random grain based on configuration */
 
-  unsigned int max_cooldown = syn->profile.max_cooldown * syn->af->samplerate;
-  unsigned int min_cooldown = syn->profile.min_cooldown * syn->af->samplerate;
+  unsigned int max_cooldown = profile->max_cooldown * syn->af->samplerate;
+  unsigned int min_cooldown = profile->min_cooldown * syn->af->samplerate;
   if (min_cooldown != max_cooldown) {
-    slot->cooldown = randr((unsigned int) (syn->profile.min_cooldown * syn->af->samplerate), (unsigned int) (syn->profile.max_cooldown * syn->af->samplerate));
+    g->cooldown[index] = randr(group, (unsigned int) (profile->min_cooldown * syn->af->samplerate), (unsigned int) (profile->max_cooldown * syn->af->samplerate));
   } else {
-    slot->cooldown = min_cooldown;
+    g->cooldown[index] = min_cooldown;
   }
 
   /* The offset is converted to an absolute offset within the file */
-  unsigned int max_offset = syn->profile.max_offset * syn->af->samplerate;
-  unsigned int min_offset = syn->profile.min_offset * syn->af->samplerate;
+  unsigned int max_offset = profile->max_offset * syn->af->samplerate;
+  unsigned int min_offset = profile->min_offset * syn->af->samplerate;
   if (min_offset != max_offset) {
-    slot->offset = randr((unsigned int) (syn->profile.min_offset * syn->af->samplerate), (unsigned int) (syn->profile.max_offset * syn->af->samplerate));
+    g->offset[index] = randr(group, (unsigned int) (profile->min_offset * syn->af->samplerate), (unsigned int) (profile->max_offset * syn->af->samplerate));
   } else {
-    slot->offset = min_offset;
+    g->offset[index] = min_offset;
   }
-  slot->offset = (syn->af->size + syn->fcursor - slot->offset) % syn->af->size;
+  g->offset[index] = (syn->af->size + fcursor - g->offset[index]) % syn->af->size;
 
-  unsigned int max_length = syn->profile.max_length * syn->af->samplerate;
-  unsigned int min_length = syn->profile.min_length * syn->af->samplerate;
+  unsigned int max_length = profile->max_length * syn->af->samplerate;
+  unsigned int min_length = profile->min_length * syn->af->samplerate;
   if (min_length != max_length) {
-    slot->length = randr((unsigned int) (syn->profile.min_length * syn->af->samplerate), (unsigned int) (syn->profile.max_length * syn->af->samplerate));
+    g->length[index] = randr(group, (unsigned int) (profile->min_length * syn->af->samplerate), (unsigned int) (profile->max_length * syn->af->samplerate));
   } else {
-    slot->length = min_length;
+    g->length[index] = min_length;
   }
 
-  slot->gain = randf(syn->profile.min_gain, syn->profile.max_gain);
-  // slot->multiplier = randf(syn->profile.min_multiplier, syn->profile.max_multiplier);
-  slot->reverse = randf(0.f, 1.f) < syn->profile.reverse_probability;
+  /* Empty grains would never finish */
+  if (g->length[index] == 0) {
+    g->length[index] = 1;
+  }
+
+  /* Step through the envelope table so one
+   * turn of the phase spans the grain */
+  g->window[index] = get_window(profile->window);
+  g->kernel[index] = profile->interpolation;
+  if (g->kernel[index] > syn->governor.interpolation) {
+    g->kernel[index] = syn->governor.interpolation;
+  }
+  g->phase_step[index] = UINT_MAX / g->length[index];
+
+  g->gain[index] = randf(group, profile->min_gain, profile->max_gain);
+  g->reverse[index] = randf(group, 0.f, 1.f) < profile->reverse_probability;
 
   int tries = 4;
   int note_index;
   do {
-    note_index = rand() % 12;
-  } while (syn->pitches_freezed[note_index] == 0 && tries--);
+    note_index = randr(group, 0, 12);
+  } while (!(syn->pitches_freezed & 1u << note_index) && tries--);
 
-  if (syn->pitches_freezed[note_index] == 0) {
-    slot->gain = 0;
+  if (!(syn->pitches_freezed & 1u << note_index)) {
+    g->gain[index] = 0;
+    g->step[index] = (uint64_t) MIX_FIXED_ONE;
   } else {
-    slot->multiplier = powf(PITCH_STEP, note_index);
-    slot->multiplier *= powf(2.f, randr(0, 6)) / 8.f;
+    float multiplier = powf(PITCH_STEP, note_index);
+    multiplier *= powf(2.f, randr(group, 0, 6)) / 8.f;
+    g->step[index] = (uint64_t) (multiplier * MIX_FIXED_ONE);
+  }
+
+  /* Grains at high rates read a decimated level of the
+   * source instead, keeping the step within it below 1.5 */
+  int level = 0;
+  while (level + 1 < AUDIO_FILE_LEVELS && g->step[index] >= (uint64_t) (1.5 * MIX_FIXED_ONE) << level) {
+    level++;
   }
+  g->level[index] = level;
+  g->step[index] >>= level;
 
-  slot->cursor = 0;
+  /* Grains at the original rate of their level read the
+   * source as is, from a whole sample of the level */
+  if (g->step[index] == (uint64_t) MIX_FIXED_ONE) {
+    g->kernel[index] = g->reverse[index] ? MIX_COPY_REVERSE : MIX_COPY;
+    g->offset[index] &= ~((1u << level) - 1);
+  }
+
+  /* Silent grains are never played, the slot
+   * sleeps through them instead */
+  if (g->gain[index] == 0.f) {
+    g->cooldown[index] += g->length[index];
+    g->cursor[index] = g->length[index];
+    return;
+  }
+
+  g->cursor[index] = 0;
 }
 
-void synthesize(struct synthesizer *syn, size_t length)
+/* Interpolate between source and target profile */
+static void interpolate_profile(struct synthesizer *syn, struct profile *profile, float profile_interp)
+{
+  float num_slots_interp = ((float) syn->source_profile.num_slots + profile_interp * ((float) syn->target_profile.num_slots - (float) syn->source_profile.num_slots));
+  profile->num_slots = (unsigned int) (num_slots_interp < .0f ? .0f : num_slots_interp);
+  profile->min_offset = syn->source_profile.min_offset + profile_interp * (syn->target_profile.min_offset - syn->source_profile.min_offset);
+  profile->max_offset = syn->source_profile.max_offset + profile_interp * (syn->target_profile.max_offset - syn->source_profile.max_offset);
+  profile->min_length = syn->source_profile.min_length + profile_interp * (syn->target_profile.min_length - syn->source_profile.min_length);
+  profile->max_length = syn->source_profile.max_length + profile_interp * (syn->target_profile.max_length - syn->source_profile.max_length);
+  profile->min_cooldown = syn->source_profile.min_cooldown + profile_interp * (syn->target_profile.min_cooldown - syn->source_profile.min_cooldown);
+  profile->max_cooldown = syn->source_profile.max_cooldown + profile_interp * (syn->target_profile.max_cooldown - syn->source_profile.max_cooldown);
+  profile->min_multiplier = syn->source_profile.min_multiplier + profile_interp * (syn->target_profile.min_multiplier - syn->source_profile.min_multiplier);
+  profile->max_multiplier = syn->source_profile.max_multiplier + profile_interp * (syn->target_profile.max_multiplier - syn->source_profile.max_multiplier);
+  profile->min_gain = syn->source_profile.min_gain + profile_interp * (syn->target_profile.min_gain - syn->source_profile.min_gain);
+  profile->max_gain = syn->source_profile.max_gain + profile_interp * (syn->target_profile.max_gain - syn->source_profile.max_gain);
+  profile->reverse_probability = syn->source_profile.reverse_probability + profile_interp * (syn->target_profile.reverse_probability - syn->source_profile.reverse_probability);
+  profile->window = syn->target_profile.window;
+  profile->interpolation = syn->target_profile.interpolation;
+}
+
+/* Limit a run of n samples from cursor so every read stays
+ * within the guard regions of the audio file, and set up the
+ * run from the grain, all but the gain. This is the only place
+ * positions are wrapped, once per run */
+static size_t fit_grain_run(const struct audio_file *af, const struct grain_key *grain,
+                            unsigned int cursor, size_t n, struct grain_run *run)
+{
+  int level = grain->level;
+  long size = af->level_size[level];
+  unsigned int rcursor = cursor;
+  unsigned int phase_step = UINT_MAX / grain->length;
+
+  if (grain->reverse) {
+    rcursor = grain->length - rcursor;
+  }
+
+  /* Wrap the first read position in to [0, size). The offset
+   * is in samples of the full rate source */
+  int64_t start = ((int64_t) grain->offset << (32 - level)) + (int64_t) rcursor * (int64_t) grain->step;
+  long first = (long) (start >> 32);
+  long wraps = first / size;
+  first -= wraps * size;
+
+  run->data = af->levels[level];
+  run->position = start - ((int64_t) (wraps * size) << 32);
+  run->step = grain->reverse ? -(int64_t) grain->step : (int64_t) grain->step;
+  run->window = grain->window;
+  run->phase = cursor * phase_step;
+  run->phase_step = phase_step;
+
+  /* Each sample moves the read position by step. Leave
+   * room for rounding and the interpolation neighbours */
+  long room;
+  if (grain->reverse) {
+    room = first + AUDIO_FILE_GUARD - 2 - INTERPOLATION_LEFT;
+  } else {
+    room = size + AUDIO_FILE_GUARD - 3 - INTERPOLATION_RIGHT - first;
+  }
+
+  size_t fit = (size_t) (((double) room * MIX_FIXED_ONE) / (double) grain->step) + 1;
+
+  return n < fit ? n : fit;
+}
+
+/* The waveform of the grain in a slot */
+static void get_grain_key(struct synthesizer *syn, size_t index, struct grain_key *key)
+{
+  struct grains *g = &syn->grains;
+
+  key->offset  = g->offset[index];
+  key->length  = g->length[index];
+  key->step    = g->step[index];
+  key->level   = g->level[index];
+  key->reverse = g->reverse[index];
+  key->kernel  = g->kernel[index];
+  key->window  = g->window[index];
+}
+
+static size_t fit_run(struct synthesizer *syn, size_t index, unsigned int cursor,
+                      size_t n, struct grain_run *run)
+{
+  struct grain_key grain;
+
+  get_grain_key(syn, index, &grain);
+  return fit_grain_run(syn->af, &grain, cursor, n, run);
+}
+
+/* Render a grain for the grain cache, at unity gain.
+ * Called by its fill thread */
+static void render_cached_grain(void *arg, const struct grain_key *key, float *data)
 {
-  if (syn->profile.num_slots > syn->slots_capac) {
-    syn->slots = xrealloc(syn->slots, sizeof(*syn->slots) * syn->profile.num_slots);
-    syn->slots_capac = syn->profile.num_slots;
+  struct synthesizer *syn = arg;
+
+  memset(data, 0, sizeof(*data) * key->length);
+  for (unsigned int cursor = 0; cursor < key->length;) {
+    struct grain_run run;
+    size_t n = fit_grain_run(syn->af, key, cursor, key->length - cursor, &run);
+    run.gain = 1.f;
+    run.gain_step = 0.f;
+    syn->mix->run[key->kernel](data + cursor, n, &run);
+    cursor += n;
   }
+}
 
-  if (syn->profile.num_slots > syn->num_slots) {
-    for (unsigned int i = syn->num_slots; i < syn->profile.num_slots; ++i) {
-      init_slot(syn, &syn->slots[i]);
-    }
+/* Look up the grain of a slot in the grain cache. A missed
+ * grain plays uncached, the fill thread of the cache renders
+ * it for next time. Only grains of pinned length are cached,
+ * their offset is quantized so they repeat */
+static void cache_slot(struct synthesizer *syn, size_t index, const struct profile *profile)
+{
+  struct grains *g = &syn->grains;
+  struct grain_key key;
+
+  if (!syn->cache || g->cursor[index] == g->length[index] ||
+      profile->min_length != profile->max_length) {
+    return;
   }
 
-  syn->num_slots = syn->profile.num_slots;
+  g->offset[index] -= g->offset[index] % GRAIN_CACHE_QUANTUM;
 
-  if (length > syn->data_size) {
-    syn->data = xrealloc(syn->data, sizeof(*syn->data) * length);
-    syn->data_size = length;
+  get_grain_key(syn, index, &key);
+  g->cached[index] = grain_cache_get(syn->cache, &key);
+}
+
+/* Create a new grain t samples in to the current block */
+static void spawn_slot(struct synthesizer *syn, size_t index, size_t t)
+{
+  init_slot(syn, index, &syn->profile, (syn->fcursor + t) % syn->af->size);
+  cache_slot(syn, index, &syn->profile);
+}
+
+/* Render an active slot from sample start to end in to out,
+ * handling cooldown, spawning and playback at their exact
+ * sample offsets. The slot is deactivated when its cooldown
+ * runs past the end */
+static void render_slot(struct synthesizer *syn, size_t index, size_t start, size_t end, float *out)
+{
+  struct grains *g = &syn->grains;
+  struct slot_group *group = &syn->groups[index / MIX_LANES];
+  unsigned int bit = 1u << (index % MIX_LANES);
+  uint64_t *wake = &syn->scheduler.wake[index];
+  size_t t = start;
+
+  /* Slots woken this period start at their wake time */
+  if (*wake > syn->clock + start) {
+    t = (size_t) (*wake - syn->clock);
   }
 
-  for (size_t i = 0; i < length; ++i) {
+  /* Scale new/old slots based on configuration interpolation */
+  int scaled = 0;
+  if (syn->source_profile.num_slots < syn->target_profile.num_slots && index > syn->source_profile.num_slots) {
+    scaled = 1;
+  } else if (syn->source_profile.num_slots > syn->target_profile.num_slots && index > syn->target_profile.num_slots) {
+    scaled = 1;
+  }
 
-    float sample = 0.f;
-    float profile_interp = 1.f - (float) syn->interp_counter / (syn->interp_time * (float) syn->af->samplerate);
+  while (t < end) {
 
-    for (unsigned int i = 0; i < syn->slots_capac; ++i) {
+    if (g->cursor[index] == g->length[index]) {
+      /* Grain finished playing, create a new one */
+      spawn_slot(syn, index, t);
 
-      struct slot *s = &syn->slots[i];
+      if (g->cooldown[index]) {
+        if (index >= syn->num_slots) {
+          /* This slot is supposed to die */
+          group->active &= ~bit;
+          return;
+        }
 
-      /* Cooldown mode while cooldown is non-zero */
-      if (s->cooldown) {
-        if (i >= syn->num_slots) {
-          /* If this grain is supposed to die,
-           * don't decrement cooldown counter */
-          continue;
+        *wake = syn->clock + t + g->cooldown[index];
+        if (t + g->cooldown[index] >= end) {
+          /* Scheduled after the period */
+          group->active &= ~bit;
+          group->sleeping |= bit;
+          return;
         }
-        s->cooldown--;
-        continue;
+        t += g->cooldown[index];
       }
+      continue;
+    }
 
-      if (s->cursor == s->length) {
-        /* Grain finished playing, create a new one */
-        init_slot(syn, s);
-        continue;
-      }
+    size_t n = g->length[index] - g->cursor[index];
+    if (n > end - t) {
+      n = end - t;
+    }
 
-      unsigned int cursor = s->cursor;
-      if (s->reverse) {
-        cursor = s->length - cursor;
-      }
+    float scaling = 1.f;
+    float scaling_step = 0.f;
+    if (scaled) {
+      scaling = syn->scaling + syn->scaling_step * (float) (t - start);
+      scaling_step = syn->scaling_step;
+    }
 
-      /* Scale cursor by multiplier */
-      float fcursor;
-      float interp = modff(s->multiplier * (float) cursor, &fcursor);
-      cursor = (unsigned int) fcursor;
+    if (g->cached[index]) {
+      /* Pre-rendered grain, a plain scaled add */
+      mix_add(out + t, g->cached[index]->data + g->cursor[index], n,
+              g->gain[index] * scaling, g->gain[index] * scaling_step);
+    } else {
+      struct grain_run run;
+      n = fit_run(syn, index, g->cursor[index], n, &run);
+      run.gain = g->gain[index] * scaling;
+      run.gain_step = g->gain[index] * scaling_step;
+      syn->mix->run[g->kernel[index]](out + t, n, &run);
+    }
 
-      /* Interpolate sample based on fractional part after scaling */
-      unsigned int lpos = (syn->af->size + s->offset + cursor) % syn->af->size;
-      unsigned int rpos = (lpos + 1) % syn->af->size;
+    g->cursor[index] += n;
+    t += n;
+  }
+}
 
-      float lsample = syn->af->data[lpos];
-      float rsample = syn->af->data[rpos];
+/* Activate a slot at the end of its cooldown, unless it
+ * is supposed to die */
+static void wake_slot(void *arg, unsigned int slot)
+{
+  struct synthesizer *syn = arg;
 
-      float af_sample = lsample + (rsample - lsample) * interp;
+  if (slot < syn->num_slots) {
+    syn->groups[slot / MIX_LANES].active |= 1u << (slot % MIX_LANES);
+  }
+}
 
-      /* Compute envelope */
-      float t = (float) s->cursor / (float) s->length;
-      // float env = 1.f - (2.f * t - 1.f) * (2.f * t - 1.f);
-      float env = t < .25f ? 4.f * t : 4.f * (1.f - t) / 3.f;
+/* Start a control period of n samples. Updates the profile
+ * and slot count, and the gain ramp of new/old slots */
+static void begin_control_period(struct synthesizer *syn, size_t start, size_t n)
+{
+  if (syn->interp_counter) {
+    interpolate_profile(syn, &syn->profile, profile_interp(syn, 0));
+  }
 
-      /* Scale new/old slots based on configuration interpolation */
-      float profile_scaling = 1.f;
-      if (syn->source_profile.num_slots < syn->target_profile.num_slots && i > syn->source_profile.num_slots) {
-        profile_scaling = profile_interp;
-      } else if (syn->source_profile.num_slots > syn->target_profile.num_slots && i > syn->target_profile.num_slots) {
-        profile_scaling = 1.f - profile_interp;
-      }
+  /* Slots above the limit of the governor die
+   * like slots dropped by the profile */
+  unsigned int num_slots = syn->profile.num_slots;
+  if (syn->governor.enabled) {
+    unsigned int limit = (unsigned int) ceilf(syn->governor.slot_limit * (float) num_slots);
+    num_slots = limit < num_slots ? limit : num_slots;
+  }
+
+  /* Slots are never allocated while rendering */
+  if (num_slots > syn->slots_capac) {
+    num_slots = syn->slots_capac;
+  }
 
-      /* Accumulate sample */
-      sample += af_sample * env * s->gain * profile_scaling;
-      s->cursor++;
+  if (num_slots > syn->num_slots) {
+    for (unsigned int i = syn->num_slots; i < num_slots; ++i) {
+      /* The slot may still be playing or sleeping
+       * from before it was supposed to die */
+      syn->groups[i / MIX_LANES].active &= ~(1u << (i % MIX_LANES));
+      unschedule_slot(&syn->scheduler, i);
+
+      init_slot(syn, i, &syn->profile, syn->fcursor);
+      cache_slot(syn, i, &syn->profile);
+      schedule_slot(&syn->scheduler, i, syn->clock + start + syn->grains.cooldown[i]);
     }
+  }
+
+  syn->num_slots = num_slots;
+
+  /* Activate slots waking within the period */
+  advance_scheduler(&syn->scheduler, syn->clock + start + n, wake_slot, syn);
 
-    syn->fcursor++;
-    if (syn->fcursor == syn->af->size) {
-      syn->fcursor = 0;
+  /* One-pole smoothing of the scaling, evaluated at the end
+   * of the period and ramped linearly in between */
+  float target = scaling_target(syn, n);
+  float decay = expf(-(float) n / (SMOOTHING_TIME * (float) syn->af->samplerate));
+  float scaling = target + (syn->scaling - target) * decay;
+
+  syn->smoothing = fabsf(scaling - target) > 1e-4f;
+  if (!syn->smoothing) {
+    scaling = target;
+  }
+
+  syn->scaling_step = (scaling - syn->scaling) / (float) n;
+}
+
+/* End a control period of n samples */
+static void end_control_period(struct synthesizer *syn, size_t n)
+{
+  /* Put slots that went to sleep during the period in
+   * the scheduler */
+  for (size_t i = 0; i < syn->groups_capac; ++i) {
+    unsigned int sleeping = syn->groups[i].sleeping;
+
+    while (sleeping) {
+      unsigned int slot = i * MIX_LANES + __builtin_ctz(sleeping);
+      schedule_slot(&syn->scheduler, slot, syn->scheduler.wake[slot]);
+      sleeping &= sleeping - 1;
     }
+    syn->groups[i].sleeping = 0;
+  }
 
-    syn->data[i] = sample;
-
-    /* Interpolate between profiles */
-    if (syn->interp_counter) {
-
-      syn->interp_counter--;
-
-      float num_slots_interp = ((float) syn->source_profile.num_slots + profile_interp * ((float) syn->target_profile.num_slots - (float) syn->source_profile.num_slots));
-      syn->profile.num_slots = (unsigned int) (num_slots_interp < .0f ? .0f : num_slots_interp);
-      syn->profile.min_offset = syn->source_profile.min_offset + profile_interp * (syn->target_profile.min_offset - syn->source_profile.min_offset);
-      syn->profile.max_offset = syn->source_profile.max_offset + profile_interp * (syn->target_profile.max_offset - syn->source_profile.max_offset);
-      syn->profile.min_length = syn->source_profile.min_length + profile_interp * (syn->target_profile.min_length - syn->source_profile.min_length);
-      syn->profile.max_length = syn->source_profile.max_length + profile_interp * (syn->target_profile.max_length - syn->source_profile.max_length);
-      syn->profile.min_cooldown = syn->source_profile.min_cooldown + profile_interp * (syn->target_profile.min_cooldown - syn->source_profile.min_cooldown);
-      syn->profile.max_cooldown = syn->source_profile.max_cooldown + profile_interp * (syn->target_profile.max_cooldown - syn->source_profile.max_cooldown);
-      syn->profile.min_multiplier = syn->source_profile.min_multiplier + profile_interp * (syn->target_profile.min_multiplier - syn->source_profile.min_multiplier);
-      syn->profile.max_multiplier = syn->source_profile.max_multiplier + profile_interp * (syn->target_profile.max_multiplier - syn->source_profile.max_multiplier);
-      syn->profile.min_gain = syn->source_profile.min_gain + profile_interp * (syn->target_profile.min_gain - syn->source_profile.min_gain);
-      syn->profile.max_gain = syn->source_profile.max_gain + profile_interp * (syn->target_profile.max_gain - syn->source_profile.max_gain);
-      syn->profile.reverse_probability = syn->source_profile.reverse_probability + profile_interp * (syn->target_profile.reverse_probability - syn->source_profile.reverse_probability);
-
-      if (syn->interp_counter == 0) {
-        log_info("Done interpolating/fading");
-      }
+  syn->scaling += syn->scaling_step * (float) n;
+  syn->scaling_step = 0.f;
+
+  if (syn->interp_counter) {
+
+    syn->interp_counter = n < syn->interp_counter ? syn->interp_counter - n : 0;
+
+    if (syn->interp_counter == 0) {
+      interpolate_profile(syn, &syn->profile, 1.f);
+      log_info_async("Done interpolating/fading");
     }
   }
+
+  if (!syn->smoothing) {
+    syn->scaling = scaling_target(syn, 0);
+  }
 }
 
-float *synthesizer_get_data_ptr(struct synthesizer *syn)
+/* Render the share of slots of one worker over the
+ * current job. Workers get whole slot groups, so their
+ * grains and random streams never overlap */
+static void render_worker(void *arg, size_t worker)
 {
-  return syn->data;
+  struct synthesizer *syn = arg;
+  size_t groups = (syn->slots_capac + MIX_LANES - 1) / MIX_LANES;
+  size_t first = groups * worker / syn->num_workers;
+  size_t last = groups * (worker + 1) / syn->num_workers;
+  float *out = syn->render_out;
+
+  if (worker) {
+    out = syn->partial[worker - 1];
+    memset(out + syn->render_start, 0, sizeof(*out) * (syn->render_end - syn->render_start));
+  }
+
+  /* Render active slots grain by grain, each grain mixes
+   * its contiguous runs straight in to the output. Slots in
+   * cooldown or playing silent grains are not visited */
+  for (size_t i = first; i < last; ++i) {
+    unsigned int active = syn->groups[i].active;
+
+    while (active) {
+      render_slot(syn, i * MIX_LANES + __builtin_ctz(active), syn->render_start, syn->render_end, out);
+      active &= active - 1;
+    }
+  }
 }
 
-void lock_synthesizer(struct synthesizer *syn)
+void synthesize(struct synthesizer *syn, size_t length)
 {
-  pthread_mutex_lock(&syn->lock);
+  /* Only grows if not reserved up front */
+  synthesizer_reserve(syn, length, 0);
+
+  synthesize_into(syn, syn->data, length);
 }
 
-void unlock_synthesizer(struct synthesizer *syn)
+void synthesize_into(struct synthesizer *syn, float *out, size_t length)
 {
-  pthread_mutex_unlock(&syn->lock);
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  /* Partial buffers only grow if not reserved up front */
+  synthesizer_reserve(syn, length, 0);
+
+  memset(out, 0, sizeof(*out) * length);
+  syn->render_out = out;
+
+  /* Slot storage, profile and pitches only change
+   * between blocks */
+  take_slot_storage(syn);
+  apply_control(syn);
+  if (!atomic_load_explicit(&syn->freeze_pitches, memory_order_relaxed)) {
+    unsigned int pitches = atomic_load_explicit(&syn->pitches, memory_order_relaxed);
+
+    /* Time and pitches go in one word, so they are
+     * never read torn */
+    if (pitches != syn->pitches_freezed) {
+      uint64_t us = (uint64_t) begin.tv_sec * 1000000 + (uint64_t) begin.tv_nsec / 1000;
+      atomic_store_explicit(&syn->pitch_change, us << 12 | pitches, memory_order_relaxed);
+    }
+    syn->pitches_freezed = pitches;
+  }
+
+  for (size_t t = 0; t < length;) {
+
+    /* The profile only changes while interpolating or
+     * smoothing, otherwise the whole block is one period */
+    size_t n = length - t;
+    if ((syn->interp_counter || syn->smoothing) && n > syn->control_period) {
+      n = syn->control_period;
+    }
+
+    begin_control_period(syn, t, n);
+
+    syn->render_start = t;
+    syn->render_end = t + n;
+    if (syn->workers) {
+      run_worker_pool(syn->workers);
+    } else {
+      render_worker(syn, 0);
+    }
+
+    end_control_period(syn, n);
+    t += n;
+  }
+
+  /* Sum partial buffers, always in the same order so the
+   * output only depends on the seed and number of threads */
+  for (size_t i = 0; i + 1 < syn->num_workers; ++i) {
+    const float *partial = syn->partial[i];
+    for (size_t t = 0; t < length; ++t) {
+      out[t] += partial[t];
+    }
+  }
+
+  syn->fcursor = (syn->fcursor + length) % syn->af->size;
+  syn->clock += length;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  syn->governor.settle_time = syn->profile.max_length;
+  update_governor(&syn->governor,
+                  (double) (end.tv_sec - begin.tv_sec) + (double) (end.tv_nsec - begin.tv_nsec) * 1e-9,
+                  (double) length / (double) syn->af->samplerate);
+  if (syn->governor.enabled) {
+    publish_governor(syn);
+  }
+}
+
+int synthesizer_set_threads(struct synthesizer *syn, size_t n)
+{
+  if (syn->workers) {
+    free_worker_pool(syn->workers);
+    syn->workers = NULL;
+  }
+
+  for (size_t i = 0; i + 1 < syn->num_workers; ++i) {
+    free(syn->partial[i]);
+  }
+  free(syn->partial);
+  syn->partial = NULL;
+  syn->num_workers = 1;
+
+  if (n <= 1) {
+    return 0;
+  }
+
+  syn->workers = create_worker_pool(n, render_worker, syn);
+  if (!syn->workers) {
+    return -1;
+  }
+
+  syn->partial = xcalloc(n - 1, sizeof(*syn->partial));
+  for (size_t i = 0; i < n - 1; ++i) {
+    syn->partial[i] = xcalloc(syn->data_size, sizeof(*syn->partial[i]));
+  }
+  syn->num_workers = n;
+
+  return 0;
+}
+
+float *synthesizer_get_data_ptr(struct synthesizer *syn)
+{
+  return syn->data;
 }
 
 void sythesizer_fade_out(struct synthesizer *syn)
 {
-  memcpy(&syn->source_profile, &syn->profile, sizeof(struct profile));
-  memcpy(&syn->target_profile, &syn->profile, sizeof(struct profile));
-  syn->target_profile.min_gain = 0.f;
-  syn->target_profile.max_gain = 0.f;
-  syn->interp_counter = (unsigned int) (syn->af->samplerate * syn->interp_time);
+  publish_control(syn, CONTROL_FADE_OUT, NULL);
 }
 
 void sythesizer_set_interp_time(struct synthesizer *syn, float t)
 {
-  syn->interp_time = t;
+  syn->control_interp_time = t;
+}
+
+void synthesizer_set_control_period(struct synthesizer *syn, unsigned int n)
+{
+  syn->control_period = n ? n : 1;
 }
 
 void synthesizer_note_on(struct synthesizer *syn, int pitch_class)
 {
-  syn->pitches[pitch_class] = 1;
+  atomic_fetch_or_explicit(&syn->pitches, 1u << pitch_class, memory_order_relaxed);
 }
 
 void synthesizer_note_off(struct synthesizer *syn, int pitch_class)
 {
-  syn->pitches[pitch_class] = 0;
+  atomic_fetch_and_explicit(&syn->pitches, ~(1u << pitch_class), memory_order_relaxed);
 }
 
 void synthesizer_freeze_pitches(struct synthesizer *syn, int b)
 {
-  syn->freeze_pitches = b;
+  atomic_store_explicit(&syn->freeze_pitches, b, memory_order_relaxed);
+}
+
+int synthesizer_get_pitch_change(struct synthesizer *syn, uint64_t *time, unsigned int *pitches)
+{
+  uint64_t change = atomic_load_explicit(&syn->pitch_change, memory_order_relaxed);
+
+  if (change == 0) {
+    return -1;
+  }
+
+  *time = change >> 12;
+  *pitches = change & 0xfff;
+  return 0;
+}
+
+int synthesizer_set_cache_size(struct synthesizer *syn, size_t bytes)
+{
+  if (syn->cache) {
+    for (size_t i = 0; i < syn->grains.capac; ++i) {
+      syn->grains.cached[i] = NULL;
+    }
+    free_grain_cache(syn->cache);
+    syn->cache = NULL;
+  }
+
+  if (bytes) {
+    syn->cache = create_grain_cache(bytes, render_cached_grain, syn);
+    if (!syn->cache) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int synthesizer_get_cache_stats(struct synthesizer *syn, struct grain_cache_stats *stats)
+{
+  if (!syn->cache) {
+    return -1;
+  }
+
+  get_grain_cache_stats(syn->cache, stats);
+  return 0;
+}
+
+void synthesizer_enable_governor(struct synthesizer *syn, int b)
+{
+  init_governor(&syn->governor);
+  syn->governor.enabled = b;
+  publish_governor(syn);
+}
+
+void synthesizer_get_governor(struct synthesizer *syn, struct governor *gov)
+{
+  triple_buffer_update(&syn->governor_status);
+  memcpy(gov, triple_buffer_front(&syn->governor_status), sizeof(struct governor));
 }
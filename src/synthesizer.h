@@ -1,8 +1,12 @@
 #ifndef SYNTHESIZER_H
 #define SYNTHESIZER_H
 
+#include <stdint.h>
+
 #include "audio-file.h"
 #include "config.h"
+#include "grain-cache.h"
+#include "governor.h"
 
 struct synthesizer;
 
@@ -11,11 +15,64 @@ struct synthesizer *create_synthesizer(struct audio_file *audio);
 
 void free_synthesizer(struct synthesizer *syn);
 
+/* Seed the random number generator used for grains. The same
+ * seed, profile, audio file and number of threads give the
+ * same output */
+void synthesizer_set_seed(struct synthesizer *syn, uint64_t seed);
+
+/* Interpolate to profile, starting at the next block. Slot
+ * storage is grown here if the profile has more slots than
+ * reserved, and taken over by the audio thread between blocks.
+ * With set_now the profile is set right away and its slots are
+ * allocated, which is only safe before the stream starts */
 void set_synthesizer_profile(struct synthesizer *syn, struct profile *profile, int set_now);
 
-/* Synthesize length samples */
+/* Allocate everything needed to synthesize blocks of up to
+ * length samples with up to num_slots slots, so synthesize
+ * never allocates. Only safe before the stream starts */
+void synthesizer_reserve(struct synthesizer *syn, size_t length, size_t num_slots);
+
+/* Number of grains started so far. Not synchronized with
+ * synthesize, call it from the thread rendering */
+uint64_t synthesizer_get_grain_count(struct synthesizer *syn);
+
+/* Longest block synthesize renders without allocating */
+size_t synthesizer_get_max_length(struct synthesizer *syn);
+
+/* Render slots on n threads, including the one calling
+ * synthesize. Grains don't depend on the number of threads,
+ * only the order they are summed in does. Returns -1 if the
+ * threads could not be started, rendering then continues on
+ * the calling thread only */
+int synthesizer_set_threads(struct synthesizer *syn, size_t n);
+
+/* Cache pre-rendered grains, using at most bytes of memory.
+ * Missed grains are rendered by a thread of the cache, so
+ * which grains play cached depends on timing, and the output
+ * only matches to rounding. Disabled if bytes is 0. Returns
+ * -1 if the thread could not be started */
+int synthesizer_set_cache_size(struct synthesizer *syn, size_t bytes);
+
+/* Returns -1 if the grain cache is disabled */
+int synthesizer_get_cache_stats(struct synthesizer *syn, struct grain_cache_stats *stats);
+
+/* Let the governor lower the number of slots and interpolation
+ * quality when rendering can't keep up with real time. Output
+ * then depends on the speed of the machine */
+void synthesizer_enable_governor(struct synthesizer *syn, int b);
+
+/* Copy out the governor state as of the last block */
+void synthesizer_get_governor(struct synthesizer *syn, struct governor *gov);
+
+/* Synthesize length samples. Never allocates, blocks or
+ * makes syscalls while length is within what was reserved,
+ * but for waking the fill thread of the grain cache */
 void synthesize(struct synthesizer *syn, size_t length);
 
+/* Synthesize length samples in to out instead of the buffer
+ * of the synthesizer */
+void synthesize_into(struct synthesizer *syn, float *out, size_t length);
+
 /* Get a pointer to synthesized samples */
 float *synthesizer_get_data_ptr(struct synthesizer *syn);
 
@@ -23,13 +80,22 @@ void sythesizer_fade_out(struct synthesizer *syn);
 
 void sythesizer_set_interp_time(struct synthesizer *syn, float t);
 
-/* Acquire/release lock on synthesizer (accessed in
- * threaded PulseAudio mainloop) */
-void lock_synthesizer(struct synthesizer *syn);
-void unlock_synthesizer(struct synthesizer *syn);
+/* Set the number of samples between profile updates
+ * while interpolating between profiles */
+void synthesizer_set_control_period(struct synthesizer *syn, unsigned int n);
 
+/* Profile changes, notes and freezing may be called from one
+ * control thread while the stream runs, synthesize never waits
+ * on them. Everything else must be set up before the stream
+ * starts */
 void synthesizer_note_on(struct synthesizer *syn, int pitch_class);
 void synthesizer_note_off(struct synthesizer *syn, int pitch_class);
 void synthesizer_freeze_pitches(struct synthesizer *syn, int b);
 
+/* Monotonic time in microseconds at the start of the last
+ * block that played a new set of held pitches, and that set.
+ * Returns -1 if the pitches never changed. For measuring
+ * control latency, may be called from any thread */
+int synthesizer_get_pitch_change(struct synthesizer *syn, uint64_t *time, unsigned int *pitches);
+
 #endif
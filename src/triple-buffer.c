@@ -0,0 +1,36 @@
+#include "xmalloc.h"
+#include "triple-buffer.h"
+
+void init_triple_buffer(struct triple_buffer *tb, size_t size)
+{
+  tb->data = xcalloc(3, size);
+  tb->size = size;
+  tb->front = 0;
+  atomic_init(&tb->middle, 1);
+  tb->back = 2;
+}
+
+void free_triple_buffer(struct triple_buffer *tb)
+{
+  free(tb->data);
+  tb->data = NULL;
+}
+
+void triple_buffer_publish(struct triple_buffer *tb)
+{
+  unsigned int middle = atomic_exchange_explicit(&tb->middle, tb->back | TRIPLE_BUFFER_NEW,
+                                                 memory_order_acq_rel);
+  tb->back = middle & ~TRIPLE_BUFFER_NEW;
+}
+
+int triple_buffer_update(struct triple_buffer *tb)
+{
+  if (!(atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLE_BUFFER_NEW)) {
+    return 0;
+  }
+
+  unsigned int middle = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+  tb->front = middle & ~TRIPLE_BUFFER_NEW;
+
+  return 1;
+}
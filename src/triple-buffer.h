@@ -0,0 +1,46 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* Wait-free hand over of a value from one writer thread to one
+ * reader thread. The writer fills the back buffer and publishes
+ * it, the reader picks up the latest published buffer. Neither
+ * side ever waits on the other, values published in between
+ * two reads are dropped */
+struct triple_buffer {
+  unsigned char        *data;
+  size_t                size;    /* Size of one buffer */
+  _Atomic unsigned int  middle;  /* Index of the middle buffer, or'ed with TRIPLE_BUFFER_NEW */
+  unsigned int          back;    /* Owned by the writer */
+  unsigned int          front;   /* Owned by the reader */
+};
+
+#define TRIPLE_BUFFER_NEW 4u
+
+/* Buffers are zeroed */
+void init_triple_buffer(struct triple_buffer *tb, size_t size);
+void free_triple_buffer(struct triple_buffer *tb);
+
+/* Buffer for the writer to fill */
+static inline void *triple_buffer_back(struct triple_buffer *tb)
+{
+  return tb->data + tb->back * tb->size;
+}
+
+/* Make the back buffer the latest value. The new back buffer
+ * holds stale data */
+void triple_buffer_publish(struct triple_buffer *tb);
+
+/* Pick up the latest value, if one was published since the
+ * last call. Returns non-zero if the front buffer changed */
+int triple_buffer_update(struct triple_buffer *tb);
+
+/* Latest value picked up by the reader */
+static inline const void *triple_buffer_front(struct triple_buffer *tb)
+{
+  return tb->data + tb->front * tb->size;
+}
+
+#endif
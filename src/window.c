@@ -0,0 +1,105 @@
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "window.h"
+
+static const char *s_names[WINDOW_COUNT] = {
+  [WINDOW_TRIANGLE]  = "triangle",
+  [WINDOW_TRAPEZOID] = "trapezoid",
+  [WINDOW_HANN]      = "hann",
+  [WINDOW_TUKEY]     = "tukey",
+  [WINDOW_GAUSSIAN]  = "gaussian",
+  [WINDOW_EXPDECAY]  = "expdecay",
+};
+
+static float s_tables[WINDOW_COUNT][WINDOW_SIZE + 2];
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+
+/* Evaluate a window at x in [0, 1] */
+static float window_value(enum window_type type, float x)
+{
+  const float pi = 3.14159265358979f;
+
+  switch (type) {
+  case WINDOW_TRIANGLE:
+    return x < .25f ? 4.f * x : 4.f * (1.f - x) / 3.f;
+
+  case WINDOW_TRAPEZOID:
+  {
+    const float ramp = .1f;
+    float w = x < 1.f - x ? x / ramp : (1.f - x) / ramp;
+    return w < 1.f ? w : 1.f;
+  }
+
+  case WINDOW_HANN:
+    return .5f - .5f * cosf(2.f * pi * x);
+
+  case WINDOW_TUKEY:
+  {
+    const float alpha = .5f;
+    float d = x < 1.f - x ? x : 1.f - x;
+    if (d >= alpha / 2.f) {
+      return 1.f;
+    }
+    return .5f - .5f * cosf(2.f * pi * d / alpha);
+  }
+
+  case WINDOW_GAUSSIAN:
+  {
+    /* Shifted down by the value at the edges and scaled
+     * back up, so it reaches zero at both ends */
+    const float sigma = .3f;
+    float d = (x - .5f) / (sigma * .5f);
+    float e = expf(-.5f / (sigma * sigma));
+    return (expf(-.5f * d * d) - e) / (1.f - e);
+  }
+
+  case WINDOW_EXPDECAY:
+  {
+    /* Decay is shifted and scaled so it reaches zero at the end */
+    const float attack = .02f;
+    const float k = 6.f;
+    if (x < attack) {
+      return x / attack;
+    }
+    float u = (x - attack) / (1.f - attack);
+    return (expf(-k * u) - expf(-k)) / (1.f - expf(-k));
+  }
+
+  default:
+    return 0.f;
+  }
+}
+
+static void build_tables(void)
+{
+  for (int type = 0; type < WINDOW_COUNT; ++type) {
+    for (int i = 0; i <= WINDOW_SIZE; ++i) {
+      s_tables[type][i] = window_value(type, (float) i / (float) WINDOW_SIZE);
+    }
+    s_tables[type][WINDOW_SIZE + 1] = s_tables[type][WINDOW_SIZE];
+  }
+}
+
+const float *get_window(enum window_type type)
+{
+  pthread_once(&s_once, build_tables);
+  return s_tables[type];
+}
+
+int get_window_by_name(const char *name)
+{
+  for (int type = 0; type < WINDOW_COUNT; ++type) {
+    if (strcmp(name, s_names[type]) == 0) {
+      return type;
+    }
+  }
+
+  return -1;
+}
+
+const char *get_window_name(enum window_type type)
+{
+  return s_names[type];
+}
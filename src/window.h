@@ -0,0 +1,31 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+/* Number of window table entries, as a power of two. Tables
+ * have two extra entries so the kernels can read past the
+ * last point */
+#define WINDOW_BITS 10
+#define WINDOW_SIZE (1 << WINDOW_BITS)
+
+/* Grain window (envelope) shapes */
+enum window_type {
+  WINDOW_TRIANGLE,    /* 25% attack, 75% decay */
+  WINDOW_TRAPEZOID,   /* 10% attack, flat top, 10% release */
+  WINDOW_HANN,
+  WINDOW_TUKEY,       /* Tapered cosine, half of the window tapered */
+  WINDOW_GAUSSIAN,
+  WINDOW_EXPDECAY,    /* Short attack, exponential decay */
+  WINDOW_COUNT,
+};
+
+/* Get the table for a window. The tables are shared
+ * by all grains and built on first use */
+const float *get_window(enum window_type type);
+
+/* Look up a window by name in the configuration file.
+ * Returns -1 if there is no such window */
+int get_window_by_name(const char *name);
+
+const char *get_window_name(enum window_type type);
+
+#endif
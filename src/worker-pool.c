@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "xmalloc.h"
+#include "rt-check.h"
+#include "worker-pool.h"
+
+/* Number of polls before falling back to a futex wait */
+#define SPIN_COUNT 256
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void) 0)
+#endif
+
+struct worker_pool {
+  pthread_t            *threads;
+  size_t                size;        /* Number of workers, including the caller */
+  worker_fn             fn;
+  void                 *arg;
+
+  _Atomic uint32_t      generation;  /* Incremented to start a job */
+  _Atomic uint32_t      pending;     /* Workers still running the current job */
+  _Atomic int           quit;
+};
+
+struct worker {
+  struct worker_pool   *pool;
+  size_t                index;
+};
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t val)
+{
+  syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr)
+{
+  syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Wait until *addr is no longer val, returns the new value */
+static uint32_t wait_while(_Atomic uint32_t *addr, uint32_t val)
+{
+  uint32_t cur;
+
+  for (int i = 0; i < SPIN_COUNT; ++i) {
+    cur = atomic_load_explicit(addr, memory_order_acquire);
+    if (cur != val) {
+      return cur;
+    }
+    cpu_relax();
+  }
+
+  while ((cur = atomic_load_explicit(addr, memory_order_acquire)) == val) {
+    futex_wait(addr, val);
+  }
+
+  return cur;
+}
+
+static void *worker_main(void *arg)
+{
+  struct worker worker = *(struct worker *) arg;
+  struct worker_pool *pool = worker.pool;
+  uint32_t generation = 0;
+
+  free(arg);
+
+  /* Workers only ever render */
+  rt_enter();
+
+  for (;;) {
+    generation = wait_while(&pool->generation, generation);
+
+    if (atomic_load_explicit(&pool->quit, memory_order_acquire)) {
+      return NULL;
+    }
+
+    pool->fn(pool->arg, worker.index);
+
+    if (atomic_fetch_sub_explicit(&pool->pending, 1, memory_order_acq_rel) == 1) {
+      futex_wake(&pool->pending);
+    }
+  }
+}
+
+struct worker_pool *create_worker_pool(size_t n, worker_fn fn, void *arg)
+{
+  struct worker_pool *pool;
+
+  if (n == 0) {
+    return NULL;
+  }
+
+  pool = xcalloc(1, sizeof(*pool));
+  pool->size = n;
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->threads = xcalloc(n, sizeof(*pool->threads));
+
+  for (size_t i = 1; i < n; ++i) {
+    struct worker *worker = xmalloc(sizeof(*worker));
+    worker->pool = pool;
+    worker->index = i;
+
+    if (pthread_create(&pool->threads[i], NULL, worker_main, worker) != 0) {
+      free(worker);
+      pool->size = i;
+      free_worker_pool(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+void free_worker_pool(struct worker_pool *pool)
+{
+  atomic_store_explicit(&pool->quit, 1, memory_order_release);
+  atomic_fetch_add_explicit(&pool->generation, 1, memory_order_release);
+  futex_wake(&pool->generation);
+
+  for (size_t i = 1; i < pool->size; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  free(pool->threads);
+  free(pool);
+}
+
+void run_worker_pool(struct worker_pool *pool)
+{
+  uint32_t pending;
+
+  atomic_store_explicit(&pool->pending, pool->size - 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&pool->generation, 1, memory_order_release);
+  futex_wake(&pool->generation);
+
+  pool->fn(pool->arg, 0);
+
+  while ((pending = atomic_load_explicit(&pool->pending, memory_order_acquire)) != 0) {
+    wait_while(&pool->pending, pending);
+  }
+}
+
+size_t get_worker_pool_size(struct worker_pool *pool)
+{
+  return pool->size;
+}
@@ -0,0 +1,25 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+
+/* Called once per worker for every job. index is in
+ * [0, number of workers), 0 being the calling thread */
+typedef void (*worker_fn)(void *arg, size_t index);
+
+struct worker_pool;
+
+/* Start n - 1 threads, the thread calling run_worker_pool
+ * is the n:th worker. Returns NULL on failure */
+struct worker_pool *create_worker_pool(size_t n, worker_fn fn, void *arg);
+
+void free_worker_pool(struct worker_pool *pool);
+
+/* Run fn on every worker and wait for all of them to finish.
+ * Workers sync through futexes, spinning briefly first, so
+ * back to back jobs don't pay for a sleep */
+void run_worker_pool(struct worker_pool *pool);
+
+size_t get_worker_pool_size(struct worker_pool *pool);
+
+#endif
@@ -42,4 +42,16 @@ static inline void *xcalloc(size_t nmemb, size_t size)
 
   return ptr;
 }
+
+static inline void *xaligned_alloc(size_t alignment, size_t size)
+{
+  void *ptr;
+
+  if (posix_memalign(&ptr, alignment, size) != 0) {
+    perror("posix_memalign");
+    abort();
+  }
+
+  return ptr;
+}
 #endif